@@ -28,5 +28,15 @@ void setAspOn(void);
 void setAspOff(void);
 void setPrivOff(void);
 void setPrivOn(void);
+uint32_t *pushSW(uint32_t *sp);
+uint32_t *popSW(uint32_t *sp);
+uint32_t countLeadingZeros(uint32_t value);
+uint32_t disableInterrupts(void);
+void restoreInterrupts(uint32_t primask);
+void loadMpuImage(uint32_t *image);
+uint32_t atomicAdd(volatile uint32_t *word, uint32_t value);
+bool compareAndSwap(volatile uint32_t *word, uint32_t expected, uint32_t value);
+uint32_t raiseBasepri(uint32_t basepri);
+void restoreBasepri(uint32_t basepri);
 
 #endif
\ No newline at end of file
@@ -27,6 +27,59 @@
     .def setPrivOn
     .def pushSW
     .def popSW
+    .def loadMpuImage
+    .def disableInterrupts
+    .def countLeadingZeros
+    .def restoreInterrupts
+    .def atomicAdd
+    .def compareAndSwap
+    .def raiseBasepri
+    .def restoreBasepri
+    .def getStackInfo
+    .def queueSend
+    .def queueReceive
+    .def malloc_heap
+    .def benchmarkQueues
+    .def openShared
+    .def getSharedInfo
+    .def getTaskInfo
+    .def getIpcInfo
+    .def getLatencyInfo
+    .def startProfile
+    .def stopProfile
+    .def semaphoreCreate
+    .def semaphoreDestroy
+    .def mutexCreate
+    .def mutexDestroy
+    .def findSemaphore
+    .def findMutex
+    .def getCycles
+    .def eventGroupCreate
+    .def eventGroupDestroy
+    .def findEventGroup
+    .def setEvents
+    .def clearEvents
+    .def waitEvents
+    .def notify
+    .def waitNotify
+    .def semaphoreWaitTimeout
+    .def mutexLockTimeout
+    .def queueReceiveTimeout
+    .def readLog
+    .def getCommands
+    .def timerCreate
+    .def timerDestroy
+    .def timerStart
+    .def timerStop
+    .def timerReset
+    .def timerFind
+    .def readExpiredTimer
+    .def uartWrite
+    .def uartRead
+    .def uartKbhit
+    .def writeUart0Dma
+    .def uartReadLine
+    .def getCrashRecord
 
 ;-----------------------------------------------------------------------------
 ; Register values and large immediate values
@@ -99,3 +152,257 @@ popSW:
 	ADD     r0, r0, #32        ; move sp past r4-r11 frame
 	BX      lr                 ; return new sp
 
+; r0 points to 4 RBAR/RASR pairs for regions 1-4 followed by the read-only window and stack guard pairs (see updateSramAccessImage)
+; MPUBASE, MPUATTR and the A1-A3 aliases are consecutive, and the VALID bit in each RBAR selects the region
+loadMpuImage:
+	PUSH    {r4-r9}
+	MOVW    r1, #0xED9C        ; r1 = MPUBASE (0xE000ED9C)
+	MOVT    r1, #0xE000
+	LDMIA   r0!, {r2-r9}       ; load the 8 words of the SRAM regions
+	STMIA   r1, {r2-r9}        ; write regions 1-4 in one burst
+	LDMIA   r0, {r2-r5}        ; load the read-only window and stack guard pairs
+	STMIA   r1, {r2-r5}        ; write regions 6 and 7
+	POP     {r4-r9}
+	BX      lr
+
+; returns PRIMASK in r0 and masks interrupts, pass the value to restoreInterrupts
+disableInterrupts:
+	MRS     r0, PRIMASK
+	CPSID   I
+	BX      lr
+
+restoreInterrupts:
+	MSR     PRIMASK, r0
+	BX      lr
+
+; masks interrupts at priority byte r0 and less urgent, returns the old BASEPRI for restoreBasepri
+; BASEPRI_MAX only ever raises the mask, so a caller that is already masked further is left alone
+raiseBasepri:
+	MRS     r1, BASEPRI
+	MSR     BASEPRI_MAX, r0
+	MOV     r0, r1
+	BX      lr
+
+restoreBasepri:
+	MSR     BASEPRI, r0
+	BX      lr
+
+; leading zero bits of r0 (32 for 0), log2 is 31 - the result
+countLeadingZeros:
+	CLZ     r0, r0
+	BX      lr
+
+; adds r1 to the word at r0 and returns the new value, retries if anything else touched the word
+; exception entry clears the exclusive monitor, so an interrupted update fails the STREX and runs again
+atomicAdd:
+	LDREX   r2, [r0]
+	ADD     r2, r2, r1
+	STREX   r3, r2, [r0]       ; r3 = 0 if the store happened
+	CMP     r3, #0
+	BNE     atomicAdd
+	MOV     r0, r2
+	BX      lr
+
+; stores r2 at r0 if the word still holds r1, returns 1 if it was stored and 0 if the value was different
+compareAndSwap:
+	LDREX   r3, [r0]
+	CMP     r3, r1
+	BNE     compareAndSwapFail
+	STREX   r3, r2, [r0]
+	CMP     r3, #0
+	BNE     compareAndSwap     ; lost the reservation, try again
+	MOV     r0, #1
+	BX      lr
+compareAndSwapFail:
+	CLREX
+	MOV     r0, #0
+	BX      lr
+
+; service calls that return a value, svCallIsr replaces the stacked r0 with the result and the stub returns it in r0
+; a C function holding only the SVC has no return statement, so these are written here (declared with the C code that calls them)
+
+; kernel.c
+getStackInfo:
+	SVC     #4
+	BX      lr
+
+queueSend:
+	SVC     #5
+	BX      lr
+
+queueReceive:
+	SVC     #6
+	BX      lr
+
+malloc_heap:
+	SVC     #7
+	BX      lr
+
+benchmarkQueues:
+	SVC     #9
+	BX      lr
+
+openShared:
+	SVC     #10
+	BX      lr
+
+getSharedInfo:
+	SVC     #12
+	BX      lr
+
+getTaskInfo:
+	SVC     #25
+	BX      lr
+
+getIpcInfo:
+	SVC     #26
+	BX      lr
+
+getLatencyInfo:
+	SVC     #28
+	BX      lr
+
+startProfile:
+	SVC     #30
+	BX      lr
+
+stopProfile:
+	SVC     #31
+	BX      lr
+
+semaphoreCreate:
+	SVC     #35
+	BX      lr
+
+semaphoreDestroy:
+	SVC     #36
+	BX      lr
+
+mutexCreate:
+	SVC     #37
+	BX      lr
+
+mutexDestroy:
+	SVC     #38
+	BX      lr
+
+findSemaphore:
+	SVC     #39
+	BX      lr
+
+findMutex:
+	SVC     #40
+	BX      lr
+
+getCycles:
+	SVC     #41
+	BX      lr
+
+eventGroupCreate:
+	SVC     #42
+	BX      lr
+
+eventGroupDestroy:
+	SVC     #43
+	BX      lr
+
+findEventGroup:
+	SVC     #44
+	BX      lr
+
+setEvents:
+	SVC     #45
+	BX      lr
+
+clearEvents:
+	SVC     #46
+	BX      lr
+
+waitEvents:
+	SVC     #47
+	BX      lr
+
+notify:
+	SVC     #48
+	BX      lr
+
+waitNotify:
+	SVC     #49
+	BX      lr
+
+semaphoreWaitTimeout:
+	SVC     #50
+	BX      lr
+
+mutexLockTimeout:
+	SVC     #51
+	BX      lr
+
+queueReceiveTimeout:
+	SVC     #52
+	BX      lr
+
+; log.c
+readLog:
+	SVC     #22
+	BX      lr
+
+; shell.c
+getCommands:
+	SVC     #24
+	BX      lr
+
+; timers.c
+timerCreate:
+	SVC     #53
+	BX      lr
+
+timerDestroy:
+	SVC     #54
+	BX      lr
+
+timerStart:
+	SVC     #55
+	BX      lr
+
+timerStop:
+	SVC     #56
+	BX      lr
+
+timerReset:
+	SVC     #57
+	BX      lr
+
+timerFind:
+	SVC     #58
+	BX      lr
+
+readExpiredTimer:
+	SVC     #59
+	BX      lr
+
+; uart0.c
+uartWrite:
+	SVC     #17
+	BX      lr
+
+uartRead:
+	SVC     #18
+	BX      lr
+
+uartKbhit:
+	SVC     #19
+	BX      lr
+
+writeUart0Dma:
+	SVC     #20
+	BX      lr
+
+uartReadLine:
+	SVC     #23
+	BX      lr
+
+; faults.c
+getCrashRecord:
+	SVC     #32
+	BX      lr
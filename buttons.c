@@ -0,0 +1,154 @@
+// Pushbutton driver
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// 6 pushbuttons (PB_0 to PB_5) to ground with internal pull-ups
+// Timer 1A debounces the edges
+
+// Any edge on a button restarts a one-shot timer, and the buttons are sampled once the timer expires,
+// so a bouncing contact costs a few short isrs and no task runs until the state has settled
+// Presses and releases are set as flags in the buttonEvents event group, which wakes the task waiting on them
+// Vector table: buttonEdgeIsr for the ports of the buttons, buttonTimerIsr for Timer 1A
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "gpio.h"
+#include "asm.h"
+#include "kernel.h"
+#include "buttons.h"
+
+#define DEBOUNCE_CYCLES (DEBOUNCE_MS * 40000)     // Timer 1A runs from the 40 MHz system clock
+#define TIMER1A_IRQ 21
+
+typedef struct _BUTTON_PIN
+{
+    PORT port;
+    uint8_t pin;
+} BUTTON_PIN;
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+const BUTTON_PIN buttonPins[BUTTON_COUNT] = {{PB_0}, {PB_1}, {PB_2}, {PB_3}, {PB_4}, {PB_5}};
+
+uint8_t buttonState = 0;                // debounced state, bit i set while PB_i is pressed
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// interrupt number of a gpio port
+uint8_t portIrq(PORT port)
+{
+    switch (port)
+    {
+        case PORTA: return 0;
+        case PORTB: return 1;
+        case PORTC: return 2;
+        case PORTD: return 3;
+        case PORTE: return 4;
+        default:    return 30;          // PORTF
+    }
+}
+
+// sets the priority of an interrupt and turns it on
+void enableIrq(uint8_t irq, uint8_t priority)
+{
+    volatile uint8_t *pri = (volatile uint8_t *)&NVIC_PRI0_R;      // one priority byte per interrupt
+    pri[irq] = PRIORITY_BYTE(priority);
+    if (irq < 32)
+        NVIC_EN0_R |= 1 << irq;
+    else
+        NVIC_EN1_R |= 1 << (irq - 32);
+}
+
+// Edge interrupts on both edges of each button and the debounce timer, call after initHw and initRtos
+void initButtons(void)
+{
+    uint8_t i;
+
+    // Timer 1A, 32-bit one-shot, started by each edge
+    SYSCTL_RCGCTIMER_R |= SYSCTL_RCGCTIMER_R1;
+    _delay_cycles(3);
+    TIMER1_CTL_R &= ~TIMER_CTL_TAEN;
+    TIMER1_CFG_R = TIMER_CFG_32_BIT_TIMER;
+    TIMER1_TAMR_R = TIMER_TAMR_TAMR_1_SHOT;
+    TIMER1_TAILR_R = DEBOUNCE_CYCLES;
+    TIMER1_ICR_R = TIMER_ICR_TATOCINT;
+    TIMER1_IMR_R = TIMER_IMR_TATOIM;
+    enableIrq(TIMER1A_IRQ, BUTTON_PRIORITY);
+
+    buttonState = sampleButtons();
+    for (i = 0; i < BUTTON_COUNT; i++)
+    {
+        disablePinInterrupt(buttonPins[i].port, buttonPins[i].pin);
+        selectPinInterruptBothEdges(buttonPins[i].port, buttonPins[i].pin);
+        clearPinInterrupt(buttonPins[i].port, buttonPins[i].pin);
+        enablePinInterrupt(buttonPins[i].port, buttonPins[i].pin);
+        enableIrq(portIrq(buttonPins[i].port), BUTTON_PRIORITY);
+    }
+}
+
+// Pressed buttons as a bitmask (bit i for PB_i), each port is read once
+uint8_t sampleButtons(void)
+{
+    uint8_t i;
+    uint8_t pressed = 0;
+    uint8_t value = 0;
+    PORT port = (PORT)0;
+    for (i = 0; i < BUTTON_COUNT; i++)
+    {
+        if (buttonPins[i].port != port)
+        {
+            port = buttonPins[i].port;
+            value = getPortValue(port);
+        }
+        if (!(value & (1 << buttonPins[i].pin)))
+            pressed |= 1 << i;
+    }
+    return pressed;
+}
+
+// Blocks until a button is pressed or released and takes the events (see BUTTON_PRESSES and BUTTON_RELEASES)
+uint16_t waitButtons(void)
+{
+    return waitEvents(buttonEvents, 0xFFFF, EVENT_WAIT_ANY | EVENT_CLEAR, WAIT_FOREVER);
+}
+
+// An edge on any button, restart the debounce timer
+void buttonEdgeIsr(void)
+{
+    uint8_t i;
+    for (i = 0; i < BUTTON_COUNT; i++)
+        clearPinInterrupt(buttonPins[i].port, buttonPins[i].pin);
+    TIMER1_CTL_R &= ~TIMER_CTL_TAEN;
+    TIMER1_TAV_R = DEBOUNCE_CYCLES;
+    TIMER1_CTL_R |= TIMER_CTL_TAEN;
+}
+
+// The buttons have been quiet for DEBOUNCE_MS, record what changed since the last stable state
+void buttonTimerIsr(void)
+{
+    uint8_t now, changed;
+    TIMER1_ICR_R = TIMER_ICR_TATOCINT;
+    now = sampleButtons();
+    changed = now ^ buttonState;
+    if (changed)
+    {
+        buttonState = now;
+        setEventsFromIsr(buttonEvents, (now & changed) | ((uint16_t)(~now & changed) << 8));
+    }
+}
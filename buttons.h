@@ -0,0 +1,43 @@
+// Pushbutton driver
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// 6 pushbuttons (PB_0 to PB_5) to ground with internal pull-ups
+// Timer 1A debounces the edges
+
+#ifndef BUTTONS_H_
+#define BUTTONS_H_
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BUTTON_COUNT 6
+#define BUTTON_PRIORITY 3               // edge and debounce isrs, between ISR_API_PRIORITY and KERNEL_PRIORITY
+#define DEBOUNCE_MS 20                  // buttons are sampled once they have been quiet this long
+
+// events: bit i of the low byte is a press of PB_i, bit i of the high byte is a release
+#define BUTTON_PRESSES(events)  ((uint8_t)(events))
+#define BUTTON_RELEASES(events) ((uint8_t)((events) >> 8))
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+void initButtons(void);
+uint8_t sampleButtons(void);
+uint16_t waitButtons(void);
+void buttonEdgeIsr(void);
+void buttonTimerIsr(void);
+
+#endif
@@ -13,20 +13,32 @@
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "tm4c123gh6pm.h"
+#include "kernel.h"
 #include "faults.h"
 #include "asm.h"
 #include "uart0.h"
+#include "log.h"
+#include "mm.h"
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+// kept across warm resets, only valid with the magic and checksum
+#pragma NOINIT(crashRecord)
+CRASH_RECORD crashRecord;
 
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
 // My printing functions
-char* uitoa(uint32_t num)
+// The Buf versions are reentrant, they write into the caller's buffer (11 characters) and return the start of the number
+char* uitoaBuf(uint32_t num, char buffer[])
 {
-    static char newString[11];          //unit32_t has max value of 4,294,967,295 so 10 spots (plus null)
-    char* ptr = &newString[10];
+    char* ptr = &buffer[10];            //unit32_t has max value of 4,294,967,295 so 10 spots (plus null)
     *ptr = '\0';
 
     if (num == 0)
@@ -43,17 +55,16 @@ char* uitoa(uint32_t num)
     return ptr;
 }
 
-char* inttohex(uint32_t num)
+char* inttohexBuf(uint32_t num, char buffer[])
 {
-    static char array[11]; // 32 bits "0xFFFFFFFF"
-    char *ptr = &array[10];
+    char *ptr = &buffer[10]; // 32 bits "0xFFFFFFFF"
     *ptr = '\0';
     int curr;
     if (num == 0) *(--ptr) = '0';
     while (num > 0)
     {
         curr = num % 16;
-        if (curr > 10) *(--ptr) = 'A' + (curr - 10);
+        if (curr >= 10) *(--ptr) = 'A' + (curr - 10);
         else *(--ptr) = '0' + curr;
         num /= 16;
     }
@@ -63,99 +74,194 @@ char* inttohex(uint32_t num)
     return ptr;
 }
 
+// not reentrant, the result is overwritten by the next call
+char* uitoa(uint32_t num)
+{
+    static char newString[11];
+    return uitoaBuf(num, newString);
+}
+
+char* inttohex(uint32_t num)
+{
+    static char array[11];
+    return inttohexBuf(num, array);
+}
+
+// sum of the words of the record before the checksum
+uint32_t crashChecksum(const CRASH_RECORD *record)
+{
+    const uint32_t *word = (const uint32_t *)record;
+    uint32_t sum = 0;
+    uint16_t i;
+    for (i = 0; i < (sizeof(CRASH_RECORD) - sizeof(uint32_t)) / sizeof(uint32_t); i++)
+        sum += word[i];
+    return sum;
+}
+
+// fills the crash record from the frame the task stacked, before anything is printed
+void saveCrash(uint32_t *psp)
+{
+    uint32_t top = (uint32_t)tcb[taskCurrent].stackBase + tcb[taskCurrent].stackAlloc;
+    uint8_t i;
+
+    crashRecord.magic = CRASH_MAGIC;
+    crashRecord.exception = getIpsr() & 0x1FF;
+    crashRecord.time = DWT_CYCCNT_R;
+    for (i = 0; i < 8; i++)
+        crashRecord.frame[i] = psp[i];
+    crashRecord.psp = (uint32_t)psp;
+    crashRecord.cfsr = NVIC_FAULT_STAT_R;
+    crashRecord.hfsr = NVIC_HFAULT_STAT_R;
+    crashRecord.mmfar = NVIC_MM_ADDR_R;
+    crashRecord.bfar = NVIC_FAULT_ADDR_R;
+    for (i = 0; i < 15 && tcb[taskCurrent].name[i] != '\0'; i++)
+        crashRecord.task[i] = tcb[taskCurrent].name[i];
+    crashRecord.task[i] = '\0';
+    crashRecord.taskIndex = taskCurrent;
+
+    // the words the task had on its stack above the frame, up to the top of its stack
+    for (i = 0; i < CRASH_STACK_WORDS && (uint32_t)(psp + 8 + i) < top; i++)
+        crashRecord.stack[i] = psp[8 + i];
+    crashRecord.stackWords = i;
+    for (; i < CRASH_STACK_WORDS; i++)
+        crashRecord.stack[i] = 0;
+
+    crashRecord.logCount = recentLog(crashRecord.log, CRASH_LOG_EVENTS);
+    crashRecord.checksum = crashChecksum(&crashRecord);
+}
+
+// called once at boot, logs a record left by the last run
+bool checkCrash(void)
+{
+    bool valid = crashRecord.magic == CRASH_MAGIC && crashRecord.checksum == crashChecksum(&crashRecord);
+    if (valid)
+        writeLog(LOG_CRASH_RECORD, crashRecord.frame[6], crashRecord.cfsr);
+    else
+        crashRecord.magic = 0;
+    return valid;
+}
+
+// copies the crash record for the shell, false if there is none (kernel side of getCrashRecord)
+bool copyCrash(CRASH_RECORD *record)
+{
+    if (crashRecord.magic != CRASH_MAGIC) return false;
+    *record = crashRecord;
+    return true;
+}
+
+void eraseCrash(void)
+{
+    crashRecord.magic = 0;
+}
+
+// copies the crash record, the record is in OS memory so tasks go through the kernel
+bool getCrashRecord(CRASH_RECORD *record);
+
+void clearCrashRecord(void)
+{
+    __asm("    SVC #33");
+}
+
+// prints the frame the task stacked when it faulted and records the fault in the log
+// the pc is only followed into flash, reading the instruction at a bad pc would fault again in here
+void dumpFault(const char type[])
+{
+    uint32_t *psp = getPsp();
+    uint32_t *msp = getMsp();
+    uint32_t status = NVIC_FAULT_STAT_R;
+    uint32_t address = 0;
+    uint32_t pc = *(psp + 6);
+    uint32_t opcode = (pc < FLASH_END) ? *((uint32_t*)(pc)) : 0;
+
+    if (status & NVIC_FAULT_STAT_MMARV)
+        address = NVIC_MM_ADDR_R;
+    else if (status & NVIC_FAULT_STAT_BFARV)
+        address = NVIC_FAULT_ADDR_R;
+
+    writeLog(LOG_TASK_FAULT, pc, status);
+    saveCrash(psp);
+
+    beginDump(1024);
+    dumpStr((char*)type); dumpStr(" fault in task "); dumpStr(tcb[taskCurrent].name); dumpStr("\n");
+    dumpStr("PSP:                   "); dumpStr(inttohex((uint32_t)psp));        dumpStr("\n");
+    dumpStr("MSP:                   "); dumpStr(inttohex((uint32_t)msp));        dumpStr("\n");
+    dumpStr("Fault Status:          "); dumpStr(inttohex(status));               dumpStr("\n");
+    dumpStr("Fault Address:         "); dumpStr(inttohex(address));              dumpStr("\n");
+    dumpStr("Offending Instruction: "); dumpStr(inttohex(opcode));               dumpStr("\n");
+    dumpStr("Address of Instruction:"); dumpStr(inttohex(pc));                   dumpStr("\n");
+    dumpStr("Stack Dump!!");                                                     dumpStr("\n");
+    dumpStr("xPSR:                  "); dumpStr(inttohex(*(psp + 7)));           dumpStr("\n");
+    dumpStr("PC:                    "); dumpStr(inttohex(pc));                   dumpStr("\n");
+    dumpStr("LR:                    "); dumpStr(inttohex(*(psp + 5)));           dumpStr("\n");
+    dumpStr("R12:                   "); dumpStr(inttohex(*(psp + 4)));           dumpStr("\n");
+    dumpStr("R3:                    "); dumpStr(inttohex(*(psp + 3)));           dumpStr("\n");
+    dumpStr("R2:                    "); dumpStr(inttohex(*(psp + 2)));           dumpStr("\n");
+    dumpStr("R1:                    "); dumpStr(inttohex(*(psp + 1)));           dumpStr("\n");
+    dumpStr("R0:                    "); dumpStr(inttohex(*psp));                 dumpStr("\n");
+    endDump();
+}
+
 // REQUIRED: code this function
 void mpuFaultIsr(void)
 {
-    uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr, mfault, address;
-    uint32_t *psp, *msp;
+    uint32_t mfault;
+    uint32_t *psp;
 
-    // go up the stack to collect values to output
+    // check the stack guard before reading the stacked frame, which may be inside the guard
     psp  = getPsp();
-    msp  = getMsp();
-    r0   = *psp;
-    r1   = *(psp + 1);
-    r2   = *(psp + 2);
-    r3   = *(psp + 3);
-    r12  = *(psp + 4);
-    lr   = *(psp + 5);
-    pc   = *(psp + 6);
-    xpsr = getIpsr();
     mfault = NVIC_FAULT_STAT_R & 0xFF;       // mem fault  bits [7:0] in FAULTSTAT
-    // offending instruction will be stored inside register NVIC_MM_ADDR_R which can only be accessed in priv
-    address = pc;
-    uint32_t opcode = *((uint32_t*)(address));
-
-    putsUart0("MPU fault in process   "); putsUart0(uitoa(pid));                     putcUart0('\n');
-    putsUart0("PSP:                   "); putsUart0(inttohex((uint32_t)psp));        putcUart0('\n');
-    putsUart0("MSP:                   "); putsUart0(inttohex((uint32_t)msp));        putcUart0('\n');
-    putsUart0("MFault Flags:          "); putsUart0(inttohex(mfault));               putcUart0('\n');
-    putsUart0("Offending Instruction: "); putsUart0(inttohex((uint32_t)opcode));     putcUart0('\n');
-    putsUart0("Address of Instruction:"); putsUart0(inttohex(address));              putcUart0('\n');
-    putsUart0("Stack Dump!!");                                                       putcUart0('\n');
-    putsUart0("xPSR:                  "); putsUart0(inttohex(xpsr));                 putcUart0('\n');
-    putsUart0("PC:                    "); putsUart0(inttohex(pc));                   putcUart0('\n');
-    putsUart0("LR:                    "); putsUart0(inttohex(lr));                   putcUart0('\n');
-    putsUart0("R12:                   "); putsUart0(inttohex(r12));                  putcUart0('\n');
-    putsUart0("R3:                    "); putsUart0(inttohex(r3));                   putcUart0('\n');
-    putsUart0("R2:                    "); putsUart0(inttohex(r2));                   putcUart0('\n');
-    putsUart0("R1:                    "); putsUart0(inttohex(r1));                   putcUart0('\n');
-    putsUart0("R0:                    "); putsUart0(inttohex(r0));                   putcUart0('\n');
-
-    while(1);
+    // a hit on the stack guard only takes down the task that overflowed
+    if (hitStackGuard(mfault, NVIC_MM_ADDR_R))
+    {
+        writeLog(LOG_STACK_OVERFLOW, (uint32_t)psp, 0);
+        recoverStackOverflow();
+        NVIC_FAULT_STAT_R = mfault;          // clear mem fault bits (write 1 to clear)
+        return;
+    }
+
+    dumpFault("MPU");
+    NVIC_FAULT_STAT_R = mfault;
+    // only the faulting task is stopped, the fault returns into the next task
+    if (!containFault())
+    {
+        flushUart0();            // the halted node never runs uart0Isr, send the report now
+        while(1);
+    }
 }
 
 // REQUIRED: code this function
 void hardFaultIsr(void)
 {
-    uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr, mfault, address;
-    uint32_t *psp, *msp;
-
-    // go up the stack to collect values to output
-    psp  = getPsp();
-    msp  = getMsp();
-    r0   = *psp;
-    r1   = *(psp + 1);
-    r2   = *(psp + 2);
-    r3   = *(psp + 3);
-    r12  = *(psp + 4);
-    lr   = *(psp + 5);
-    pc   = *(psp + 6);
-    xpsr = getIpsr();
-    mfault = NVIC_FAULT_STAT_R & 0xFF;       // mem fault  bits [7:0] in FAULTSTAT
-    address = pc;
-    uint32_t opcode = *((uint32_t*)(address));
-
-    putsUart0("Hard fault in process  "); putsUart0(uitoa(pid));                     putcUart0('\n');
-    putsUart0("PSP:                   "); putsUart0(inttohex((uint32_t)psp));        putcUart0('\n');
-    putsUart0("MSP:                   "); putsUart0(inttohex((uint32_t)msp));        putcUart0('\n');
-    putsUart0("MFault Flags:          "); putsUart0(inttohex(mfault));               putcUart0('\n');
-    putsUart0("Offending Instruction: "); putsUart0(inttohex((uint32_t)opcode));     putcUart0('\n');
-    putsUart0("Address of Instruction:"); putsUart0(inttohex(address));              putcUart0('\n');
-    putsUart0("Stack Dump!!");                                                       putcUart0('\n');
-    putsUart0("xPSR:                  "); putsUart0(inttohex(xpsr));                 putcUart0('\n');
-    putsUart0("PC:                    "); putsUart0(inttohex(pc));                   putcUart0('\n');
-    putsUart0("LR:                    "); putsUart0(inttohex(lr));                   putcUart0('\n');
-    putsUart0("R12:                   "); putsUart0(inttohex(r12));                  putcUart0('\n');
-    putsUart0("R3:                    "); putsUart0(inttohex(r3));                   putcUart0('\n');
-    putsUart0("R2:                    "); putsUart0(inttohex(r2));                   putcUart0('\n');
-    putsUart0("R1:                    "); putsUart0(inttohex(r1));                   putcUart0('\n');
-    putsUart0("R0:                    "); putsUart0(inttohex(r0));                   putcUart0('\n');
-
-    while(1);
+    dumpFault("Hard");
+    NVIC_FAULT_STAT_R = NVIC_FAULT_STAT_R;   // clear the escalated fault and the hard fault status
+    NVIC_HFAULT_STAT_R = NVIC_HFAULT_STAT_R;
+    if (!containFault())
+    {
+        flushUart0();
+        while(1);
+    }
 }
 
 // REQUIRED: code this function
 void busFaultIsr(void)
 {
-    putsUart0("Bus fault in process "); putsUart0(uitoa(pid)); putcUart0('\n');
-
-    while(1);
+    dumpFault("Bus");
+    NVIC_FAULT_STAT_R = NVIC_FAULT_STAT_R & 0xFF00;      // bus fault bits [15:8]
+    if (!containFault())
+    {
+        flushUart0();
+        while(1);
+    }
 }
 
 // REQUIRED: code this function
 void usageFaultIsr(void)
 {
-    putsUart0("Usage fault in process "); putsUart0(uitoa(pid)); putcUart0('\n');
-
-    while(1);
+    dumpFault("Usage");
+    NVIC_FAULT_STAT_R = NVIC_FAULT_STAT_R & 0xFFFF0000;  // usage fault bits [31:16]
+    if (!containFault())
+    {
+        flushUart0();
+        while(1);
+    }
 }
@@ -11,12 +11,55 @@
 #ifndef FAULTS_H_
 #define FAULTS_H_
 
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "log.h"
+
+#define CRASH_MAGIC 0x43525348      // "CRSH"
+#define CRASH_STACK_WORDS 16
+#define CRASH_LOG_EVENTS 8
+
+// written by the fault handlers to SRAM that is not initialized at boot, so it survives a warm reset
+// tools/crashdecode.py symbolizes the output of the crash command
+typedef struct _CRASH_RECORD
+{
+    uint32_t magic;
+    uint32_t exception;            // IPSR of the handler: 3 hard, 4 mpu, 5 bus, 6 usage
+    uint32_t time;                 // DWT cycle count
+    uint32_t frame[8];             // r0-r3, r12, lr, pc, xpsr stacked by the task
+    uint32_t psp;
+    uint32_t cfsr;
+    uint32_t hfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+    char task[16];
+    uint8_t taskIndex;
+    uint8_t stackWords;            // words of stack above the frame in stack[]
+    uint8_t logCount;              // events in log[], oldest first
+    uint32_t stack[CRASH_STACK_WORDS];
+    LOG_ENTRY log[CRASH_LOG_EVENTS];
+    uint32_t checksum;             // sum of the words before it
+} CRASH_RECORD;
+
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
+char* uitoaBuf(uint32_t num, char buffer[]);
+char* inttohexBuf(uint32_t num, char buffer[]);
 char* uitoa(uint32_t num);
 char* inttohex(uint32_t num);
+void saveCrash(uint32_t *psp);
+bool checkCrash(void);
+bool copyCrash(CRASH_RECORD *record);
+void eraseCrash(void);
+bool getCrashRecord(CRASH_RECORD *record);
+void clearCrashRecord(void);
+void dumpFault(const char type[]);
 void mpuFaultIsr(void);
 void hardFaultIsr(void);
 void busFaultIsr(void);
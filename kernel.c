@@ -19,6 +19,9 @@
 #include "faults.h"
 #include "asm.h"
 #include "uart0.h"
+#include "log.h"
+#include "shell.h"
+#include "timers.h"
 
 //-----------------------------------------------------------------------------
 // RTOS Defines and Kernel Variables
@@ -27,22 +30,74 @@
 // mutex
 typedef struct _mutex
 {
-    bool lock;
+    bool used;                     // slot holds a mutex (see newMutex)
+    uint8_t generation;            // part of the handle, changes when the slot is reused
+    char name[IPC_NAME_SIZE];
     uint8_t queueSize;
     uint8_t processQueue[MAX_MUTEX_QUEUE_SIZE];
-    uint8_t lockedBy;
+    uint32_t lockTime;             // cycle count when the owner got the mutex through the kernel
+    bool timed;                    // lockTime is valid (fast path locks are not timed)
+    LOCK_STATS stats;
 } mutex;
 mutex mutexes[MAX_MUTEXES];
 
 // semaphore
 typedef struct _semaphore
 {
-    uint8_t count;
+    bool used;                     // slot holds a semaphore (see newSemaphore)
+    uint8_t generation;            // part of the handle, changes when the slot is reused
+    char name[IPC_NAME_SIZE];
     uint8_t queueSize;
     uint8_t processQueue[MAX_SEMAPHORE_QUEUE_SIZE];
+    LOCK_STATS stats;
 } semaphore;
 semaphore semaphores[MAX_SEMAPHORES];
 
+// event group
+typedef struct _eventGroup
+{
+    bool used;                     // slot holds an event group (see newEventGroup)
+    uint8_t generation;            // part of the handle, changes when the slot is reused
+    char name[IPC_NAME_SIZE];
+    uint32_t flags;
+    uint8_t queueSize;
+    uint8_t processQueue[MAX_EVENT_WAITERS]; // in the order they blocked, each with its own mask in the tcb
+} eventGroup;
+eventGroup eventGroups[MAX_EVENT_GROUPS];
+
+// lock-free fast paths
+// semaphore counts and mutex owners live in the first heap block, which initRtos takes
+// with FAST_IPC_PATHS every task maps it, so wait/post/lock/unlock update them with LDREX/STREX and only enter
+// the kernel to block or wake a task, the page is then only a hint: wait lists stay in kernel memory and the
+// kernel range checks what it reads back (see mutexOwner), a task can still disturb other tasks through it
+// the kernel changes them with plain stores, exception entry clears the exclusive monitor so a task's
+// STREX that was interrupted fails and retries
+#define IPC_PAGE ((FAST_IPC *)HEAP_START)
+#define SEMAPHORE_WAITERS 0x80000000      // tasks are blocked (the count is 0)
+#define MUTEX_WAITERS     0x80000000      // tasks are blocked on the owner or its hold is timed, unlock goes to the kernel
+typedef struct _FAST_IPC
+{
+    volatile uint32_t current;                          // index of the running task, set at each switch
+    volatile uint32_t semaphore[MAX_SEMAPHORES];        // count | SEMAPHORE_WAITERS
+    volatile uint32_t mutex[MAX_MUTEXES];               // 0 free, else (owner + 1) | MUTEX_WAITERS
+    volatile uint32_t acquired[MAX_SEMAPHORES + MAX_MUTEXES]; // acquisitions on the fast path
+    volatile uint8_t semaphoreGeneration[MAX_SEMAPHORES]; // copy of the handle generation, 0 when unused
+    volatile uint8_t mutexGeneration[MAX_MUTEXES];
+} FAST_IPC;
+
+// message queue
+// messages are heap allocations (the pointer returned by mallocHeap), the kernel owns them while queued
+typedef struct _queue
+{
+    uint8_t count;
+    uint8_t head;
+    void *messages[MAX_QUEUE_SIZE];
+    uint8_t queueSize;
+    uint8_t processQueue[MAX_QUEUE_WAITERS];
+} queue;
+queue queues[MAX_QUEUES + 1];
+#define BENCH_QUEUE MAX_QUEUES // private queue used by benchmarkQueues
+
 // task states
 #define STATE_INVALID           0 // no task
 #define STATE_UNRUN             1 // task has never been run
@@ -51,32 +106,136 @@ semaphore semaphores[MAX_SEMAPHORES];
 #define STATE_BLOCKED_SEMAPHORE 4 // has run, but now blocked by semaphore
 #define STATE_BLOCKED_MUTEX     5 // has run, but now blocked by mutex
 #define STATE_KILLED            6 // task has been killed
+#define STATE_BLOCKED_QUEUE     7 // has run, but now waiting for a message
+#define STATE_BLOCKED_EVENT     8 // has run, but now waiting for event flags
+#define STATE_BLOCKED_NOTIFY    9 // has run, but now waiting for a notification
+
+// names for ps and ipcs (flash)
+const char* const stateNames[] = {"invalid", "unrun", "ready", "delayed", "blocked", "blocked", "killed", "blocked", "blocked", "blocked"};
+const char* const queueNames[MAX_QUEUES] = {"queue0", "queue1"};
 
 // task
 uint8_t taskCurrent = 0;          // index of last dispatched task
 uint8_t taskCount = 0;            // total number of valid tasks
+bool rtosStarted = false;         // thread mode code is task code from here on
+uint32_t dispatchTime = 0;        // cycle count when taskCurrent was dispatched
+bool yielding = false;            // the pending switch was requested by yield
+
+// reboot leaves a magic in SRAM that is not initialized at boot, so the next boot knows it was warm
+#define WARM_BOOT_MAGIC 0x5741524D  // "WARM"
+#pragma NOINIT(bootMagic)
+uint32_t bootMagic;
+bool warmBoot = false;            // this boot came from reboot, cosmetic delays and boot dumps are skipped
+
+// boot phase timestamps, printed by printBootPhases once the uart is up
+#define MAX_BOOT_PHASES 10
+const char *bootPhaseNames[MAX_BOOT_PHASES];
+uint32_t bootPhaseTimes[MAX_BOOT_PHASES];
+uint8_t bootPhaseCount = 0;
+
+// requests from interrupts that preempt the kernel, isrs only add to the ring (under BASEPRI) and pend pendsv
+#define ISR_POST       0
+#define ISR_QUEUE_SEND 1
+#define ISR_EVENT_SET  2
+#define ISR_NOTIFY     3
+typedef struct _ISR_REQUEST
+{
+    uint8_t type;
+    uint16_t target;              // semaphore or event group handle, queue, or task and action for ISR_NOTIFY
+    uint32_t value;               // payload size for ISR_QUEUE_SEND, bits for ISR_EVENT_SET, value for ISR_NOTIFY
+    uint8_t data[ISR_MESSAGE_SIZE]; // payload of ISR_QUEUE_SEND, put in a heap message by runIsrRequests
+} ISR_REQUEST;
+ISR_REQUEST isrRequests[MAX_ISR_REQUESTS];
+volatile uint8_t isrIn = 0;
+volatile uint8_t isrOut = 0;
+uint16_t isrDropped = 0;          // requests lost to a full ring, logged by runIsrRequests
+
+// profiler, samples go in kernel owned heap blocks that are handed to the task that stops it
+uint32_t *profileBuffer = NULL;
+uint32_t profileTop = 0;          // end of the buffer's blocks (the pointer free_heap takes)
+uint16_t profileSize = 0;
+uint16_t profileCount = 0;
 
 // control
 bool priorityScheduler = true;    // priority (true) or round-robin (false)
 bool priorityInheritance = false; // priority inheritance for mutexes
 bool preemption = false;          // preemption (true) or cooperative (false)
+bool stackGuard = true;           // mpu guard below each new task stack
+bool overflowRestart = false;     // restart (true) or kill (false) a task that overflows its stack
+bool faultRestart = true;         // restart (true) or kill (false) a task that faults
+
+// fault containment, a task that keeps faulting waits twice as long before each restart
+#define FAULT_BACKOFF_MS  100
+#define FAULT_BACKOFF_MAX 6       // longest wait is FAULT_BACKOFF_MS << FAULT_BACKOFF_MAX
+
+// service call numbers
+#define SVC_YIELD   0
+#define SVC_SLEEP   1
+#define SVC_KILL    2
+#define SVC_RESTART 3
+#define SVC_STACKS  4
+#define SVC_QUEUE_SEND    5
+#define SVC_QUEUE_RECEIVE 6
+#define SVC_MALLOC  7
+#define SVC_FREE    8
+#define SVC_QBENCH  9
+#define SVC_SHM_OPEN  10
+#define SVC_SHM_CLOSE 11
+#define SVC_SHM_INFO  12
+#define SVC_WAIT    13
+#define SVC_POST    14
+#define SVC_LOCK    15
+#define SVC_UNLOCK  16
+#define SVC_UART_WRITE 17
+#define SVC_UART_READ  18
+#define SVC_UART_KBHIT 19
+#define SVC_UART_DMA   20
+#define SVC_LOG_WRITE  21
+#define SVC_LOG_READ   22
+#define SVC_UART_LINE  23
+#define SVC_COMMANDS   24
+#define SVC_TASK_INFO  25
+#define SVC_IPC_INFO   26
+#define SVC_IPC_RESET  27
+#define SVC_LATENCY    28
+#define SVC_LATENCY_RESET 29
+#define SVC_PROFILE_START 30
+#define SVC_PROFILE_STOP  31
+#define SVC_CRASH         32
+#define SVC_CRASH_CLEAR   33
+#define SVC_REBOOT        34
+#define SVC_SEMAPHORE_CREATE  35
+#define SVC_SEMAPHORE_DESTROY 36
+#define SVC_MUTEX_CREATE      37
+#define SVC_MUTEX_DESTROY     38
+#define SVC_SEMAPHORE_FIND    39
+#define SVC_MUTEX_FIND        40
+#define SVC_CYCLES            41
+#define SVC_EVENT_CREATE      42
+#define SVC_EVENT_DESTROY     43
+#define SVC_EVENT_FIND        44
+#define SVC_EVENT_SET         45
+#define SVC_EVENT_CLEAR       46
+#define SVC_EVENT_WAIT        47
+#define SVC_NOTIFY            48
+#define SVC_NOTIFY_WAIT       49
+#define SVC_WAIT_TIMEOUT      50
+#define SVC_LOCK_TIMEOUT      51
+#define SVC_QUEUE_RECEIVE_TIMEOUT 52
+#define SVC_TIMER_CREATE      53
+#define SVC_TIMER_DESTROY     54
+#define SVC_TIMER_START       55
+#define SVC_TIMER_STOP        56
+#define SVC_TIMER_RESET       57
+#define SVC_TIMER_FIND        58
+#define SVC_TIMER_EXPIRED     59
+
+// system timer
+#define SYSTICK_RELOAD (40000 - 1) // 1ms at 40 MHz
 
 // tcb
 #define NUM_PRIORITIES   8
-//struct _tcb
-//{
-//    uint8_t state;                 // see STATE_ values above
-//    void *pid;                     // used to uniquely identify thread (add of task fn)
-//    void *sp;                      // current stack pointer
-//    uint8_t priority;              // 0=highest
-//    uint8_t currentPriority;       // 0=highest (needed for pi)
-//    uint32_t ticks;                // ticks until sleep complete
-//    uint64_t srd;                  // MPU subregion disable bits
-//    char name[16];                 // name of task used in ps command
-//    uint8_t mutex;                 // index of the mutex in use or blocking the thread
-//    uint8_t semaphore;             // index of the semaphore that is blocking the thread
-//} tcb[MAX_TASKS];
-
+// struct _tcb is in kernel.h so the memory manager can update srd and mpuImage
 struct _tcb tcb[MAX_TASKS];
 
 /* from kernel.h:
@@ -95,309 +254,1770 @@ typedef void (*_fn)();
 #define keyReleased 1
 #define flashReq 2
 
-// tasks
-#define MAX_TASKS 12
-*/
+// tasks
+#define MAX_TASKS 12
+*/
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// makes a blocked or delayed task ready and timestamps the wakeup for its latency histogram
+void wakeTask(uint8_t task)
+{
+    tcb[task].state = STATE_READY;
+    tcb[task].woken = true;
+    tcb[task].readyTime = DWT_CYCCNT_R;
+    tcb[task].waitTimed = false;
+}
+
+// removes a task from a wait list, false if it was not in it
+bool removeWaiter(uint8_t processQueue[], uint8_t *queueSize, uint8_t task)
+{
+    uint8_t i;
+    for (i = 0; i < *queueSize && processQueue[i] != task; i++);
+    if (i == *queueSize) return false;
+    for (i++; i < *queueSize; i++)
+        processQueue[i - 1] = processQueue[i];
+    (*queueSize)--;
+    return true;
+}
+
+// adds the time from wakeup to dispatch of a task to its histogram
+void countLatency(uint8_t task, uint32_t now)
+{
+    uint32_t latency = now - tcb[task].readyTime;
+    int8_t bucket = (31 - countLeadingZeros(latency)) - LATENCY_SHIFT;
+    if (bucket < 0) bucket = 0;
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    if (tcb[task].latency[bucket] < 0xFFFF) tcb[task].latency[bucket]++;
+    if (latency > tcb[task].maxLatency) tcb[task].maxLatency = latency;
+    tcb[task].woken = false;
+}
+
+// contention stats, a few cycles on each lock operation
+// the current task starts waiting
+void countBlocked(LOCK_STATS *stats)
+{
+    stats->contended++;
+    tcb[taskCurrent].waitStart = DWT_CYCCNT_R;
+}
+
+// a blocked task is handed the semaphore or mutex
+void countHandoff(LOCK_STATS *stats, uint8_t task)
+{
+    uint32_t wait = DWT_CYCCNT_R - tcb[task].waitStart;
+    stats->acquisitions++;
+    stats->waitCycles += wait;
+    if (wait > stats->maxWaitCycles) stats->maxWaitCycles = wait;
+}
+
+// the holder of a mutex gives it up
+void countRelease(mutex *m)
+{
+    uint32_t hold = DWT_CYCCNT_R - m->lockTime;
+    if (!m->timed) return;
+    m->timed = false;
+    m->stats.holdCycles += hold;
+    if (hold > m->stats.maxHoldCycles) m->stats.maxHoldCycles = hold;
+}
+
+// tcb index of the task holding a mutex, MAX_TASKS if it is free
+// an owner that is not a task (a page value written by a task, see FAST_IPC_PATHS) counts as free
+uint8_t mutexOwner(uint8_t mutex)
+{
+    uint32_t value = IPC_PAGE->mutex[mutex] & ~MUTEX_WAITERS;
+    if (value == 0 || value > MAX_TASKS || tcb[value - 1].state == STATE_INVALID) return MAX_TASKS;
+    return value - 1;
+}
+
+// gives a mutex to the next waiting task, or frees it
+void releaseMutex(uint8_t mutex)
+{
+    uint8_t i;
+    countRelease(&mutexes[mutex]);
+    if (mutexes[mutex].queueSize > 0)
+    {
+        uint8_t nextTask = mutexes[mutex].processQueue[0];
+        // shift queue
+        for (i = 1; i < mutexes[mutex].queueSize; i++)
+        {
+            mutexes[mutex].processQueue[i - 1] = mutexes[mutex].processQueue[i];
+        }
+        mutexes[mutex].queueSize--;
+        countHandoff(&mutexes[mutex].stats, nextTask);
+        // the waiters bit stays set so the new owner unlocks through the kernel and ends the timed hold
+        IPC_PAGE->mutex[mutex] = (nextTask + 1) | MUTEX_WAITERS;
+        mutexes[mutex].lockTime = DWT_CYCCNT_R;
+        mutexes[mutex].timed = true;
+        wakeTask(nextTask);
+    }
+    else
+    {
+        IPC_PAGE->mutex[mutex] = 0;
+    }
+}
+
+// copies an object name, truncated to IPC_NAME_SIZE - 1 characters (NULL gives an empty name)
+void copyIpcName(char dst[], const char src[])
+{
+    uint8_t i = 0;
+    if (src != NULL)
+    {
+        for (; i < IPC_NAME_SIZE - 1 && src[i] != 0; i++)
+            dst[i] = src[i];
+    }
+    dst[i] = 0;
+}
+
+// true if name matches an object name (compared up to the stored length)
+bool sameIpcName(const char objectName[], const char name[])
+{
+    uint8_t i;
+    for (i = 0; i < IPC_NAME_SIZE - 1; i++)
+    {
+        if (objectName[i] != name[i]) return false;
+        if (name[i] == 0) return true;
+    }
+    return name[i] == 0;
+}
+
+// a new generation for a reused slot, 0 is skipped so no valid handle is NO_HANDLE
+uint8_t nextGeneration(uint8_t generation)
+{
+    generation++;
+    return generation ? generation : 1;
+}
+
+// returns the slot of a semaphore handle, or MAX_SEMAPHORES if the handle is stale or invalid
+uint8_t semaphoreIndex(HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    if (i < MAX_SEMAPHORES && semaphores[i].used && semaphores[i].generation == HANDLE_GENERATION(handle))
+        return i;
+    return MAX_SEMAPHORES;
+}
+
+// returns the slot of a mutex handle, or MAX_MUTEXES if the handle is stale or invalid
+uint8_t mutexIndex(HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    if (i < MAX_MUTEXES && mutexes[i].used && mutexes[i].generation == HANDLE_GENERATION(handle))
+        return i;
+    return MAX_MUTEXES;
+}
+
+// takes a semaphore from the pool (kernel side of createSemaphore), NO_HANDLE if the pool is full
+HANDLE newSemaphore(uint8_t count, const char name[])
+{
+    uint8_t i;
+    for (i = 0; i < MAX_SEMAPHORES && semaphores[i].used; i++);
+    if (i == MAX_SEMAPHORES) return NO_HANDLE;
+    semaphores[i].used = true;
+    semaphores[i].generation = nextGeneration(semaphores[i].generation);
+    copyIpcName(semaphores[i].name, name);
+    semaphores[i].queueSize = 0;
+    semaphores[i].stats = (LOCK_STATS){0};
+    IPC_PAGE->semaphore[i] = count;
+    IPC_PAGE->acquired[i] = 0;
+    IPC_PAGE->semaphoreGeneration[i] = semaphores[i].generation;
+    return MAKE_HANDLE(i, semaphores[i].generation);
+}
+
+// takes a mutex from the pool (kernel side of createMutex), NO_HANDLE if the pool is full
+HANDLE newMutex(const char name[])
+{
+    uint8_t i;
+    for (i = 0; i < MAX_MUTEXES && mutexes[i].used; i++);
+    if (i == MAX_MUTEXES) return NO_HANDLE;
+    mutexes[i].used = true;
+    mutexes[i].generation = nextGeneration(mutexes[i].generation);
+    copyIpcName(mutexes[i].name, name);
+    mutexes[i].queueSize = 0;
+    mutexes[i].timed = false;
+    mutexes[i].stats = (LOCK_STATS){0};
+    IPC_PAGE->mutex[i] = 0;
+    IPC_PAGE->acquired[MAX_SEMAPHORES + i] = 0;
+    IPC_PAGE->mutexGeneration[i] = mutexes[i].generation;
+    return MAKE_HANDLE(i, mutexes[i].generation);
+}
+
+// returns a semaphore to the pool, refused for kernel semaphores and while tasks wait on it
+bool deleteSemaphore(HANDLE handle)
+{
+    uint8_t i = semaphoreIndex(handle);
+    if (i < KERNEL_SEMAPHORES || i == MAX_SEMAPHORES || semaphores[i].queueSize > 0) return false;
+    semaphores[i].used = false;
+    IPC_PAGE->semaphoreGeneration[i] = 0;
+    return true;
+}
+
+// returns a mutex to the pool, refused while it is locked
+bool deleteMutex(HANDLE handle)
+{
+    uint8_t i = mutexIndex(handle);
+    if (i == MAX_MUTEXES || mutexOwner(i) != MAX_TASKS) return false;
+    mutexes[i].used = false;
+    IPC_PAGE->mutexGeneration[i] = 0;
+    return true;
+}
+
+// returns the slot of an event group handle, or MAX_EVENT_GROUPS if the handle is stale or invalid
+uint8_t eventGroupIndex(HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    if (i < MAX_EVENT_GROUPS && eventGroups[i].used && eventGroups[i].generation == HANDLE_GENERATION(handle))
+        return i;
+    return MAX_EVENT_GROUPS;
+}
+
+// takes an event group from the pool with no flags set (kernel side of createEventGroup)
+HANDLE newEventGroup(const char name[])
+{
+    uint8_t i;
+    for (i = 0; i < MAX_EVENT_GROUPS && eventGroups[i].used; i++);
+    if (i == MAX_EVENT_GROUPS) return NO_HANDLE;
+    eventGroups[i].used = true;
+    eventGroups[i].generation = nextGeneration(eventGroups[i].generation);
+    copyIpcName(eventGroups[i].name, name);
+    eventGroups[i].flags = 0;
+    eventGroups[i].queueSize = 0;
+    return MAKE_HANDLE(i, eventGroups[i].generation);
+}
+
+// returns an event group to the pool, refused for kernel groups and while tasks wait on it
+bool deleteEventGroup(HANDLE handle)
+{
+    uint8_t i = eventGroupIndex(handle);
+    if (i < KERNEL_EVENT_GROUPS || i == MAX_EVENT_GROUPS || eventGroups[i].queueSize > 0) return false;
+    eventGroups[i].used = false;
+    return true;
+}
+
+// handle of the named semaphore, mutex or event group, NO_HANDLE if there is none
+HANDLE lookupIpc(uint8_t type, const char name[])
+{
+    uint8_t i;
+    if (type == IPC_SEMAPHORE)
+    {
+        for (i = 0; i < MAX_SEMAPHORES; i++)
+            if (semaphores[i].used && sameIpcName(semaphores[i].name, name))
+                return MAKE_HANDLE(i, semaphores[i].generation);
+    }
+    else if (type == IPC_EVENT)
+    {
+        for (i = 0; i < MAX_EVENT_GROUPS; i++)
+            if (eventGroups[i].used && sameIpcName(eventGroups[i].name, name))
+                return MAKE_HANDLE(i, eventGroups[i].generation);
+    }
+    else
+    {
+        for (i = 0; i < MAX_MUTEXES; i++)
+            if (mutexes[i].used && sameIpcName(mutexes[i].name, name))
+                return MAKE_HANDLE(i, mutexes[i].generation);
+    }
+    return NO_HANDLE;
+}
+
+// service calls that return a value are stubs in asm.s, svCallIsr replaces the stacked r0 with the result
+HANDLE semaphoreCreate(uint8_t count, const char name[]);
+bool semaphoreDestroy(HANDLE handle);
+HANDLE mutexCreate(const char name[]);
+bool mutexDestroy(HANDLE handle);
+
+// creates a semaphore, name is optional and shown by ipcs
+// main calls the kernel directly, tasks go through a service call
+HANDLE createSemaphore(uint8_t count, const char name[])
+{
+    if (calledFromTask())
+        return semaphoreCreate(count, name);
+    return newSemaphore(count, name);
+}
+
+HANDLE createMutex(const char name[])
+{
+    if (calledFromTask())
+        return mutexCreate(name);
+    return newMutex(name);
+}
+
+bool destroySemaphore(HANDLE handle)
+{
+    if (calledFromTask())
+        return semaphoreDestroy(handle);
+    return deleteSemaphore(handle);
+}
+
+bool destroyMutex(HANDLE handle)
+{
+    if (calledFromTask())
+        return mutexDestroy(handle);
+    return deleteMutex(handle);
+}
+
+// handle of a semaphore or mutex created elsewhere, tasks cannot read handles kept in kernel memory
+HANDLE findSemaphore(const char name[]);
+HANDLE findMutex(const char name[]);
+HANDLE eventGroupCreate(const char name[]);
+bool eventGroupDestroy(HANDLE handle);
+
+// creates an event group with no flags set, name is optional and shown by ipcs
+HANDLE createEventGroup(const char name[])
+{
+    if (calledFromTask())
+        return eventGroupCreate(name);
+    return newEventGroup(name);
+}
+
+bool destroyEventGroup(HANDLE handle)
+{
+    if (calledFromTask())
+        return eventGroupDestroy(handle);
+    return deleteEventGroup(handle);
+}
+
+HANDLE findEventGroup(const char name[]);
+
+bool initQueue(uint8_t queue)
+{
+    bool ok = (queue < MAX_QUEUES);
+    if (ok)
+    {
+        queues[queue].count = 0;
+        queues[queue].head = 0;
+        queues[queue].queueSize = 0;
+    }
+    return ok;
+}
+
+// REQUIRED: initialize systick for 1ms system timer
+void initRtos(void)
+{
+    uint8_t i;
+    // no tasks running
+    taskCount = 0;
+    // clear out tcb records
+    for (i = 0; i < MAX_TASKS; i++)
+    {
+        tcb[i].state = STATE_INVALID;
+        tcb[i].pid = 0;
+        tcb[i].srd = 0;
+        tcb[i].stackBase = 0;
+        tcb[i].guarded = false;
+        tcb[i].cycles = 0;
+        tcb[i].voluntary = 0;
+        tcb[i].involuntary = 0;
+        tcb[i].woken = false;
+        updateSramAccessImage(i);   // keep a valid mpu image even with no allocations
+    }
+    // svc, pendsv and systick at the least urgent level so device isrs can preempt them
+    NVIC_SYS_PRI2_R = (NVIC_SYS_PRI2_R & ~NVIC_SYS_PRI2_SVC_M) | (PRIORITY_BYTE(KERNEL_PRIORITY) << 24);
+    NVIC_SYS_PRI3_R = (NVIC_SYS_PRI3_R & ~(NVIC_SYS_PRI3_TICK_M | NVIC_SYS_PRI3_PENDSV_M))
+                    | (PRIORITY_BYTE(KERNEL_PRIORITY) << 24) | (PRIORITY_BYTE(KERNEL_PRIORITY) << 16);
+    // the page of fast path words must be the first heap block (IPC_PAGE)
+    allocKernelBuffer(sizeof(FAST_IPC));
+    IPC_PAGE->current = 0;
+    // empty the object pools, the kernel semaphores take the first slots (see kernel.h)
+    for (i = 0; i < MAX_SEMAPHORES; i++)
+    {
+        semaphores[i].used = false;
+        IPC_PAGE->semaphoreGeneration[i] = 0;
+    }
+    for (i = 0; i < MAX_MUTEXES; i++)
+    {
+        mutexes[i].used = false;
+        IPC_PAGE->mutexGeneration[i] = 0;
+    }
+    for (i = 0; i < MAX_EVENT_GROUPS; i++)
+        eventGroups[i].used = false;
+    initTimers();
+    newSemaphore(0, "uartTxSpace");
+    newSemaphore(0, "uartRxLine");
+    newSemaphore(0, "uartDmaDone");
+    newEventGroup("buttons");
+}
+
+// starts the cycle counter used for timestamps, called first in main so boot phases are timed
+void initCycleCounter(void)
+{
+    DEMCR_R |= DEMCR_TRCENA;
+    DWT_CYCCNT_R = 0;
+    DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;
+}
+
+// reads and clears the warm boot magic left by reboot
+bool checkWarmBoot(void)
+{
+    warmBoot = bootMagic == WARM_BOOT_MAGIC;
+    bootMagic = 0;
+    return warmBoot;
+}
+
+// marks the end of a boot phase
+void bootPhase(const char name[])
+{
+    if (bootPhaseCount < MAX_BOOT_PHASES)
+    {
+        bootPhaseNames[bootPhaseCount] = name;
+        bootPhaseTimes[bootPhaseCount] = DWT_CYCCNT_R;
+        bootPhaseCount++;
+    }
+}
+
+// prints the time of each boot phase in us, counted from initCycleCounter
+void printBootPhases(void)
+{
+    uint32_t last = 0;
+    uint8_t i;
+    putsUart0(warmBoot ? "warm boot:" : "cold boot:");
+    for (i = 0; i < bootPhaseCount; i++)
+    {
+        putcUart0(' ');
+        putsUart0(bootPhaseNames[i]);
+        putcUart0(' ');
+        putsUart0(uitoa((bootPhaseTimes[i] - last) / 40));
+        putsUart0("us");
+        last = bootPhaseTimes[i];
+    }
+    putsUart0(", total ");
+    putsUart0(uitoa(last / 40));
+    putsUart0("us\n");
+}
+
+// kernel side of reboot, the magic makes the next boot a warm boot
+void resetSystem(void)
+{
+    bootMagic = WARM_BOOT_MAGIC;
+    NVIC_APINT_R = NVIC_APINT_VECTKEY | NVIC_APINT_SYSRESETREQ;
+    while (true);
+}
+
+// resets the processor and peripherals (SYSRESETREQ), SRAM is kept
+void reboot(void)
+{
+    __asm("    SVC #34");
+}
+
+// reads the cycle counter, the DWT is only accessible in privileged mode
+uint32_t getCycles(void);
+
+// REQUIRED: Implement prioritization to NUM_PRIORITIES
+// loop through tcb and return index of next task to run
+uint8_t rtosScheduler(void)
+{
+    if (priorityScheduler)
+    {
+        // priority based scheduling
+        uint8_t highestPriority = 8; // higher than max
+        uint8_t selectedTask = 0xFF; // invalid
+        // find highest priority ready task
+        int i;
+        for (i = 0; i < taskCount; i++)
+        {
+            if ((tcb[i].state == STATE_READY || tcb[i].state == STATE_UNRUN) && (tcb[i].priority < highestPriority))
+            {
+                highestPriority = tcb[i].priority;
+                selectedTask = i;
+            }
+        }
+        taskCurrent = selectedTask;
+        return selectedTask;
+    }
+    else
+    {
+        // round robin scheduling
+        bool ok = false;
+        uint8_t task = taskCurrent; // start searching from next task
+        while (!ok)
+        {
+            task++;
+            if (task >= taskCount) task = 0;
+            ok = (tcb[task].state == STATE_READY || tcb[task].state == STATE_UNRUN);
+        }
+        taskCurrent = task;
+        return task;
+    }
+}
+
+// REQUIRED: modify this function to start the operating system
+// by calling scheduler, set srd bits, setting PSP, ASP bit, call fn with fn add in R0
+// fn set TMPL bit, and PC <= fn
+void startRtos(void)
+{
+    uint8_t task = rtosScheduler();
+    // set srd bits
+    loadMpuImage(tcb[task].mpuImage);
+    tcb[task].state = STATE_READY;
+    IPC_PAGE->current = task;
+
+    writeLog(LOG_BOOT, (uint32_t)tcb[task].sp, 0);
+
+    // 1ms system timer for sleep
+    NVIC_ST_CTRL_R = 0;
+    NVIC_ST_RELOAD_R = SYSTICK_RELOAD;
+    NVIC_ST_CURRENT_R = 0;
+    NVIC_ST_CTRL_R = NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_INTEN | NVIC_ST_CTRL_ENABLE;
+    dispatchTime = DWT_CYCCNT_R;
+    rtosStarted = true;
+
+    // set PSP
+    setPsp(tcb[task].sp);
+    if (!warmBoot) printStack(tcb[task].sp);
+
+    // set ASP bit
+    setAspOn();
+
+    // jump to thread
+    _fn entry = (_fn)tcb[task].pid;
+    setPrivOff();
+    entry();              // jump to task; never returns
+
+    // TODO: ?
+    // call fn with fn add in R0
+    // fn set TMPL bit
+    // and PC <= fn
+}
+
+// allocate the stack of a task and make the hw stack frame for its first run
+// heap blocks and srd bits are assigned to taskCurrent, so it is switched to the task during the allocation
+bool makeStack(uint8_t task)
+{
+    uint8_t current = taskCurrent;
+    uint32_t blocks = (tcb[task].stackBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    taskCurrent = task;
+    uint32_t *sp = (uint32_t *)mallocHeap(tcb[task].stackBytes); // top of block allocated
+    taskCurrent = current;
+    if (sp == NULL) return false;
+
+    tcb[task].stackAlloc = blocks * BLOCK_SIZE;
+    tcb[task].stackBase = (void *)((uint32_t)sp - tcb[task].stackAlloc);
+    tcb[task].stackPeak = 0;
+    tcb[task].guarded = stackGuard;
+    if (FAST_IPC_PATHS) addSramAccessWindow(&tcb[task].srd, (uint32_t *)IPC_PAGE, BLOCK_SIZE); // fast path words
+    updateSramAccessImage(task);        // add guard region to the image
+
+    // paint the stack so measureStack can find the deepest word ever written
+    uint32_t *p;
+    for (p = (uint32_t *)tcb[task].stackBase; p < sp; p++)
+    {
+        *p = STACK_PAINT;
+    }
+
+    // make hw stack frame for first run
+    *(--sp) = 0x01000000;               // xPSR
+    *(--sp) = (uint32_t)tcb[task].pid;  // PC
+    *(--sp) = 0;                        // LR
+    *(--sp) = 0;                        // R12
+    *(--sp) = 0;                        // R3
+    *(--sp) = 0;                        // R2
+    *(--sp) = 0;                        // R1
+    *(--sp) = 0;                        // R0
+    tcb[task].sp = (void *) sp; // pointer to spot R0 is in
+    return true;
+}
+
+// free the memory of a task, take it out of any semaphore or mutex queue,
+// pass on any mutex it holds and mark it as killed
+void stopTask(uint8_t task)
+{
+    uint8_t i, j;
+
+    // remove from semaphore queue
+    for (i = 0; i < MAX_SEMAPHORES; i++)
+    {
+        for (j = 0; j < semaphores[i].queueSize; j++)
+        {
+            if (semaphores[i].processQueue[j] == task)
+            {
+                for (j++; j < semaphores[i].queueSize; j++)
+                {
+                    semaphores[i].processQueue[j - 1] = semaphores[i].processQueue[j];
+                }
+                semaphores[i].queueSize--;
+                if (semaphores[i].queueSize == 0) IPC_PAGE->semaphore[i] &= ~SEMAPHORE_WAITERS;
+            }
+        }
+    }
+
+    // remove from message queue
+    for (i = 0; i < MAX_QUEUES; i++)
+    {
+        for (j = 0; j < queues[i].queueSize; j++)
+        {
+            if (queues[i].processQueue[j] == task)
+            {
+                for (j++; j < queues[i].queueSize; j++)
+                {
+                    queues[i].processQueue[j - 1] = queues[i].processQueue[j];
+                }
+                queues[i].queueSize--;
+            }
+        }
+    }
+
+    // remove from event group waiters
+    if (tcb[task].state == STATE_BLOCKED_EVENT)
+        removeWaiter(eventGroups[tcb[task].eventGroup].processQueue, &eventGroups[tcb[task].eventGroup].queueSize, task);
+    tcb[task].waitTimed = false;
+    tcb[task].notifyValue = 0;
+    tcb[task].notifyPending = false;
+
+    for (i = 0; i < MAX_MUTEXES; i++)
+    {
+        // remove from mutex queue
+        for (j = 0; j < mutexes[i].queueSize; j++)
+        {
+            if (mutexes[i].processQueue[j] == task)
+            {
+                for (j++; j < mutexes[i].queueSize; j++)
+                {
+                    mutexes[i].processQueue[j - 1] = mutexes[i].processQueue[j];
+                }
+                mutexes[i].queueSize--;
+            }
+        }
+        // unlock mutex, giving it to the next task if one is waiting
+        if (mutexes[i].used && mutexOwner(i) == task)
+        {
+            releaseMutex(i);
+        }
+    }
+
+    freeTaskHeap(task);
+    tcb[task].stackBase = 0;
+    tcb[task].woken = false;
+    tcb[task].restartPending = false;
+    tcb[task].state = STATE_KILLED;
+}
+
+// finds the high-water mark of a task by scanning up from the bottom of its stack for the first unpainted word
+// the guard is skipped since it can never be written
+uint32_t measureStack(uint8_t task)
+{
+    uint32_t *p = (uint32_t *)tcb[task].stackBase;
+    uint32_t *top = (uint32_t *)((uint32_t)tcb[task].stackBase + tcb[task].stackAlloc);
+    if (p == NULL) return 0;
+    if (tcb[task].guarded) p += STACK_GUARD_BYTES / 4;
+    while (p < top && *p == STACK_PAINT)
+    {
+        p++;
+    }
+    uint32_t used = (uint32_t)top - (uint32_t)p;
+    if (used > tcb[task].stackPeak) tcb[task].stackPeak = used;
+    return tcb[task].stackPeak;
+}
+
+// returns the tcb index of fn or MAX_TASKS if not found
+uint8_t findTask(_fn fn)
+{
+    uint8_t i;
+    for (i = 0; i < MAX_TASKS; i++)
+    {
+        if (tcb[i].state != STATE_INVALID && tcb[i].pid == fn) return i;
+    }
+    return MAX_TASKS;
+}
+
+// REQUIRED:
+// add task if room in task list
+// store the thread name
+// allocate stack space and store top of stack in sp and spInit
+// set the srd bits based on the memory allocation
+bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes)
+{
+    bool ok = false;
+    uint8_t i = 0;
+    bool found = false;
+    if (taskCount < MAX_TASKS)
+    {
+        // make sure fn not already in list (prevent redundancy)
+        while (!found && (i < taskCount))
+        {
+            found = (tcb[i].pid == fn);
+            i++;
+        }
+        if (!found)
+        {
+            // find first available tcb record
+            i = 0;
+            while (tcb[i].state != STATE_INVALID) {i++;}
+            tcb[i].state = STATE_UNRUN;
+            tcb[i].pid = fn;
+            tcb[i].priority = priority;
+            tcb[i].stackBytes = stackBytes;
+            // copy name
+            uint8_t j;
+            for (j = 0; j < 15 && name[j] != 0; j++)
+            {
+                tcb[i].name[j] = name[j];
+            }
+
+            // tcb[i].srd applied inside malloc(addSramAccessWindow)
+            if (makeStack(i))
+            {
+                if (!warmBoot) printStack(tcb[i].sp);
+                taskCount++;
+                ok = true;
+            }
+            else
+            {
+                tcb[i].state = STATE_INVALID;
+                tcb[i].pid = 0;
+            }
+        }
+    }
+    return ok;
+}
+
+// creates the threads of a table in one pass at boot, before any thread is killed
+// records are filled in order, so there is no search for duplicates or free records, and nothing is printed
+bool createThreads(const THREAD_DESC threads[], uint8_t count)
+{
+    bool ok = (taskCount + count) <= MAX_TASKS;
+    uint8_t k, j;
+    for (k = 0; ok && k < count; k++)
+    {
+        uint8_t i = taskCount;
+        tcb[i].pid = threads[k].fn;
+        tcb[i].priority = threads[k].priority;
+        tcb[i].stackBytes = threads[k].stackBytes;
+        for (j = 0; j < 15 && threads[k].name[j] != 0; j++)
+        {
+            tcb[i].name[j] = threads[k].name[j];
+        }
+
+        if (threads[k].start)
+        {
+            tcb[i].state = STATE_UNRUN;
+            ok = makeStack(i);
+        }
+        else
+            tcb[i].state = STATE_KILLED;   // run NAME allocates the stack
+
+        if (ok)
+            taskCount++;
+        else
+        {
+            tcb[i].state = STATE_INVALID;
+            tcb[i].pid = 0;
+        }
+    }
+    return ok;
+}
+
+// copies name, allocated and peak stack bytes of each task into info, returns the number of tasks copied
+uint8_t getStackInfo(STACK_INFO info[]);
+
+// sends a heap allocation (pointer returned by malloc_heap) to a queue, the caller loses access to it
+// returns false if the queue is full or the caller does not own msg
+bool queueSend(uint8_t queue, void *msg);
+
+// waits for a message and returns it, the caller becomes the owner of its blocks
+void *queueReceive(uint8_t queue);
+
+// waits up to timeout ticks for a message, NULL if none arrived (0 polls, WAIT_FOREVER never gives up)
+void *queueReceiveTimeout(uint8_t queue, uint32_t timeout);
+
+// allocates heap blocks for the calling task, returns the top of the blocks
+void *malloc_heap(uint32_t size_in_bytes);
+
+// frees blocks allocated with malloc_heap (p is the pointer it returned)
+void free_heap(void *p)
+{
+    __asm("    SVC #8");
+}
+
+// fills result with the per message cost of a zero copy and a copy based queue, returns the number of sizes
+uint8_t benchmarkQueues(QUEUE_BENCH result[]);
+
+// maps the shared region name into the calling task, creating it if it does not exist yet
+// readOnly maps it so the task can only read it, returns the base address of the region or NULL
+void *openShared(const char name[], uint32_t size_in_bytes, bool readOnly);
+
+// removes the shared region name from the calling task, the last task to close it frees it
+void closeShared(const char name[])
+{
+    __asm("    SVC #11");
+}
+
+// copies up to max task mappings of the shared regions into info, returns the number copied
+uint8_t getSharedInfo(SHARED_INFO info[], uint8_t max);
+
+// copies a snapshot of every task slot and the cycle count it was taken at, returns the number of slots
+uint8_t getTaskInfo(TASK_INFO info[], uint32_t *time);
+
+// copies a snapshot of the semaphores, mutexes and queues, returns the number of entries
+uint8_t getIpcInfo(IPC_INFO info[]);
+
+// clears the semaphore and mutex contention counters
+void resetIpcStats(void)
+{
+    __asm("    SVC #27");
+}
+
+// starts sampling the interrupted pc each tick into a new buffer of up to samples entries, false if there is no heap space
+bool startProfile(uint16_t samples);
+
+// stops the profiler and gives the sample buffer to the caller, who frees it with free_heap(*top)
+// returns the number of samples, *samples is NULL if the profiler was not started
+uint16_t stopProfile(uint32_t **samples, void **top);
+
+// allocates the sample buffer and starts sampling (svc context), a running profile is discarded
+bool beginProfile(uint16_t samples)
+{
+    if (profileBuffer != NULL) freeKernelBuffer((char *)profileBuffer);
+    profileSize = 0;
+    profileCount = 0;
+    if (samples == 0 || samples > PROFILE_MAX_SAMPLES) samples = PROFILE_MAX_SAMPLES;
+    profileBuffer = (uint32_t *)allocKernelBuffer(samples * 4);
+    if (profileBuffer == NULL) return false;
+    profileTop = (uint32_t)profileBuffer + ((samples * 4 + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    profileSize = samples;
+    return true;
+}
+
+// stops sampling and hands the buffer to task (svc context)
+uint16_t endProfile(uint32_t **samples, void **top, uint8_t task)
+{
+    uint16_t count = profileCount;
+    profileSize = 0;
+    profileCount = 0;
+    *samples = profileBuffer;
+    *top = (void *)profileTop;
+    if (profileBuffer != NULL) transferHeap((void *)profileTop, MAX_TASKS, task);
+    profileBuffer = NULL;
+    return count;
+}
+
+// copies the wakeup latency histogram of every task slot, returns the number of slots
+uint8_t getLatencyInfo(LATENCY_INFO info[]);
+
+// clears the wakeup latency histograms
+void resetLatency(void)
+{
+    __asm("    SVC #29");
+}
+
+// fills the task snapshot (svc context, so nothing changes while it is copied)
+// the running task (the caller) is charged for its cycles up to now
+uint8_t copyTaskInfo(TASK_INFO info[], uint32_t *time)
+{
+    uint32_t now = DWT_CYCCNT_R;
+    uint8_t task, j, q;
+    for (task = 0; task < taskCount; task++)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            info[task].name[j] = tcb[task].name[j];
+        }
+        info[task].pid = tcb[task].pid;
+        info[task].state = stateNames[tcb[task].state];
+        info[task].blockedOn[0] = 0;
+        if (tcb[task].state == STATE_BLOCKED_SEMAPHORE)
+            copyIpcName(info[task].blockedOn, semaphores[tcb[task].semaphore].name);
+        else if (tcb[task].state == STATE_BLOCKED_MUTEX)
+            copyIpcName(info[task].blockedOn, mutexes[tcb[task].mutex].name);
+        else if (tcb[task].state == STATE_BLOCKED_EVENT)
+            copyIpcName(info[task].blockedOn, eventGroups[tcb[task].eventGroup].name);
+        else if (tcb[task].state == STATE_BLOCKED_NOTIFY)
+            copyIpcName(info[task].blockedOn, "notify");
+        else if (tcb[task].state == STATE_BLOCKED_QUEUE)
+        {
+            for (q = 0; q < MAX_QUEUES; q++)
+            {
+                for (j = 0; j < queues[q].queueSize; j++)
+                {
+                    if (queues[q].processQueue[j] == task) copyIpcName(info[task].blockedOn, queueNames[q]);
+                }
+            }
+        }
+        info[task].priority = tcb[task].priority;
+        info[task].ticks = (tcb[task].state == STATE_DELAYED) ? tcb[task].ticks : 0;
+        info[task].cycles = tcb[task].cycles;
+        if (task == taskCurrent) info[task].cycles += now - dispatchTime;
+        info[task].voluntary = tcb[task].voluntary;
+        info[task].involuntary = tcb[task].involuntary;
+        // killed and not started tasks have no stack, sp and stackAlloc are left from the last one
+        info[task].stackAlloc = (tcb[task].stackBase != 0) ? tcb[task].stackAlloc : 0;
+        info[task].stackUsed = (tcb[task].stackBase != 0) ? (uint32_t)tcb[task].stackBase + tcb[task].stackAlloc - (uint32_t)tcb[task].sp : 0;
+        info[task].stackPeak = tcb[task].stackPeak;
+        info[task].heapBytes = heapOwned(task);
+        if (tcb[task].stackBase != 0) info[task].heapBytes -= tcb[task].stackAlloc;
+    }
+    *time = now;
+    return taskCount;
+}
+
+// fills the ipc snapshot with the objects in use (svc context)
+uint8_t copyIpcInfo(IPC_INFO info[])
+{
+    uint8_t count = 0;
+    uint8_t i, j;
+    for (i = 0; i < MAX_SEMAPHORES; i++)
+    {
+        if (!semaphores[i].used) continue;
+        copyIpcName(info[count].name, semaphores[i].name);
+        info[count].handle = MAKE_HANDLE(i, semaphores[i].generation);
+        info[count].type = IPC_SEMAPHORE;
+        info[count].value = IPC_PAGE->semaphore[i] & ~SEMAPHORE_WAITERS;
+        info[count].waiters = semaphores[i].queueSize;
+        for (j = 0; j < semaphores[i].queueSize; j++)
+            info[count].waiter[j] = semaphores[i].processQueue[j];
+        info[count].stats = semaphores[i].stats;
+        info[count].stats.acquisitions += IPC_PAGE->acquired[i];
+        count++;
+    }
+    for (i = 0; i < MAX_MUTEXES; i++)
+    {
+        if (!mutexes[i].used) continue;
+        copyIpcName(info[count].name, mutexes[i].name);
+        info[count].handle = MAKE_HANDLE(i, mutexes[i].generation);
+        info[count].type = IPC_MUTEX;
+        info[count].value = mutexOwner(i) != MAX_TASKS;
+        info[count].owner = mutexOwner(i);
+        info[count].waiters = mutexes[i].queueSize;
+        for (j = 0; j < mutexes[i].queueSize; j++)
+            info[count].waiter[j] = mutexes[i].processQueue[j];
+        info[count].stats = mutexes[i].stats;
+        info[count].stats.acquisitions += IPC_PAGE->acquired[MAX_SEMAPHORES + i];
+        count++;
+    }
+    for (i = 0; i < MAX_QUEUES; i++, count++)
+    {
+        copyIpcName(info[count].name, queueNames[i]);
+        info[count].handle = NO_HANDLE;
+        info[count].type = IPC_QUEUE;
+        info[count].value = queues[i].count;
+        info[count].waiters = queues[i].queueSize;
+        for (j = 0; j < queues[i].queueSize; j++)
+            info[count].waiter[j] = queues[i].processQueue[j];
+        info[count].stats = (LOCK_STATS){0};
+    }
+    for (i = 0; i < MAX_EVENT_GROUPS; i++)
+    {
+        if (!eventGroups[i].used) continue;
+        copyIpcName(info[count].name, eventGroups[i].name);
+        info[count].handle = MAKE_HANDLE(i, eventGroups[i].generation);
+        info[count].type = IPC_EVENT;
+        info[count].value = eventGroups[i].flags;
+        info[count].waiters = eventGroups[i].queueSize;
+        for (j = 0; j < eventGroups[i].queueSize; j++)
+            info[count].waiter[j] = eventGroups[i].processQueue[j];
+        info[count].stats = (LOCK_STATS){0};
+        count++;
+    }
+    return count;
+}
+
+// clears the contention counters (svc context)
+// a held mutex keeps its lock time, so its current hold still counts
+void clearIpcStats(void)
+{
+    uint8_t i;
+    for (i = 0; i < MAX_SEMAPHORES; i++)
+        semaphores[i].stats = (LOCK_STATS){0};
+    for (i = 0; i < MAX_MUTEXES; i++)
+        mutexes[i].stats = (LOCK_STATS){0};
+    for (i = 0; i < MAX_SEMAPHORES + MAX_MUTEXES; i++)
+        IPC_PAGE->acquired[i] = 0;
+}
+
+// REQUIRED: modify this function to kill a thread
+// REQUIRED: free memory, reMOVe any pending semaphore waiting,
+//           unlock any mutexes, mark state as killed
+void killThread(_fn fn)
+{
+    __asm("    SVC #2");
+}
+
+// REQUIRED: modify this function to restart a thread, including creating a stack
+void restartThread(_fn fn)
+{
+    __asm("    SVC #3");
+}
+
+// returns true if a memory fault at address (or while stacking) hit the stack guard of the current task
+bool hitStackGuard(uint32_t mfault, uint32_t address)
+{
+    uint32_t guard = (uint32_t)tcb[taskCurrent].stackBase;
+    if (!tcb[taskCurrent].guarded) return false;
+    if (mfault & NVIC_FAULT_STAT_MSTKE) return true;   // exception stacking ran into the guard
+    return (mfault & NVIC_FAULT_STAT_MMARV) && (address >= guard) && (address < guard + STACK_GUARD_BYTES);
+}
+
+// restarts a stopped task after a backoff that doubles with each fault, so a task that
+// faults on every run does not starve the others
+// the task waits as DELAYED with no stack, systickIsr makes its stack and marks it UNRUN
+// the stack is not made here: called from a fault handler, the freed stack is usually handed straight back
+// while the guard of the task is still loaded, and painting it would fault again
+void restartLater(uint8_t task)
+{
+    uint8_t shift = tcb[task].faults < FAULT_BACKOFF_MAX ? tcb[task].faults : FAULT_BACKOFF_MAX;
+    if (tcb[task].faults < 0xFF) tcb[task].faults++;
+    tcb[task].ticks = (uint32_t)FAULT_BACKOFF_MS << shift;
+    tcb[task].restartPending = true;
+    tcb[task].state = STATE_DELAYED;
+    writeLog(LOG_TASK_RESTART, task, tcb[task].ticks);
+}
+
+// kills or restarts only the task that overflowed its stack
+// the new stack is made by systickIsr (see restartLater), the guard still loaded here may cover the freed blocks
+// a task whose stack is already freed is left alone, so a second guard hit cannot stop it twice
+void overflowTask(uint8_t task)
+{
+    if (tcb[task].stackBase == 0) return;
+    stopTask(task);
+    if (overflowRestart) restartLater(task);
+}
+
+// called from mpuFaultIsr on a stack guard hit
+// pendSvIsr will not save the context of the task (killed or waiting for its restart, with no stack),
+// so the fault returns straight into the next task
+void recoverStackOverflow(void)
+{
+    overflowTask(taskCurrent);
+    NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+}
+
+// called from the fault handlers, kills or restarts only the faulting task
+// a fault is contained when it came from thread mode after startRtos (RETTOBASE: no other
+// handler was active), anything else faulted inside the kernel and returns false
+bool containFault(void)
+{
+    if (!rtosStarted || !(NVIC_INT_CTRL_R & NVIC_INT_CTRL_RET_BASE)) return false;
+    stopTask(taskCurrent);
+    if (faultRestart) restartLater(taskCurrent);
+    NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    return true;
+}
+
+// the current task waited on or locked a stale or invalid handle (svc context)
+// it cannot carry on as if it got the semaphore or mutex, so it is stopped like a fault and restarted with faultRestart
+void badHandle(HANDLE handle)
+{
+    writeLog(LOG_BAD_HANDLE, handle, taskCurrent);
+    stopTask(taskCurrent);
+    if (faultRestart) restartLater(taskCurrent);
+    NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+}
+
+// REQUIRED: modify this function to set a thread priority
+void setThreadPriority(_fn fn, uint8_t priority)
+{
+}
+
+// REQUIRED: modify this function to yield execution back to scheduler using pendsv
+// kernel will switch tasks while saveing the context necessary for the resuming later
+void yield(void)
+{
+    // thread is unprivileged, so svc is needed to call pendsv (only available in priv mode)
+    // svc pushes the task registers onto the PSP for context saving
+    __asm("    SVC #0");
+}
+
+// REQUIRED: modify this function to support 1ms system timer
+// execution yielded back to scheduler until time elapses using pendsv
+void sleep(uint32_t tick)
+{
+    __asm("    SVC #1");
+}
+
+// takes a semaphore for the current task, or blocks it and requests a task switch (svc and kernel context)
+// a stale or invalid handle stops the task (see badHandle)
+void waitSemaphore(HANDLE handle)
+{
+    uint8_t semaphore = semaphoreIndex(handle);
+    if (semaphore == MAX_SEMAPHORES)
+    {
+        badHandle(handle);
+        return;
+    }
+
+    // if semaphore is available, decrement count
+    if (IPC_PAGE->semaphore[semaphore] > 0 && !(IPC_PAGE->semaphore[semaphore] & SEMAPHORE_WAITERS))
+    {
+        IPC_PAGE->semaphore[semaphore]--;
+        semaphores[semaphore].stats.acquisitions++;
+    }
+    else
+    {
+        // otherwise, block the task, the waiters bit sends posts to the kernel
+        IPC_PAGE->semaphore[semaphore] = SEMAPHORE_WAITERS;
+        countBlocked(&semaphores[semaphore].stats);
+        tcb[taskCurrent].state = STATE_BLOCKED_SEMAPHORE;
+        tcb[taskCurrent].semaphore = semaphore;
+        // add to semaphore queue, it holds every task
+        semaphores[semaphore].processQueue[semaphores[semaphore].queueSize++] = taskCurrent;
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+// gives a semaphore to the next waiting task or increments its count (svc, kernel and isr context)
+void signalSemaphore(HANDLE handle)
+{
+    uint8_t semaphore = semaphoreIndex(handle);
+    if (semaphore == MAX_SEMAPHORES) return;
+
+    // if queue is not empty, give to next task
+    if (semaphores[semaphore].queueSize > 0)
+    {
+        uint8_t nextTask = semaphores[semaphore].processQueue[0];
+        // shift queue
+        uint8_t i;
+        for (i = 1; i < semaphores[semaphore].queueSize; i++)
+        {
+            semaphores[semaphore].processQueue[i - 1] = semaphores[semaphore].processQueue[i];
+        }
+        semaphores[semaphore].queueSize--;
+        if (semaphores[semaphore].queueSize == 0) IPC_PAGE->semaphore[semaphore] = 0;
+        countHandoff(&semaphores[semaphore].stats, nextTask);
+        wakeTask(nextTask);
+        if (preemption) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+    else
+    {
+        IPC_PAGE->semaphore[semaphore]++;
+    }
+}
+
+// locks a mutex for the current task, or blocks it and requests a task switch
+// a stale or invalid handle stops the task (see badHandle)
+void lockMutex(HANDLE handle)
+{
+    uint8_t mutex = mutexIndex(handle);
+    if (mutex == MAX_MUTEXES)
+    {
+        badHandle(handle);
+        return;
+    }
+
+    // if mutex is available, lock it
+    if (mutexOwner(mutex) == MAX_TASKS)
+    {
+        IPC_PAGE->mutex[mutex] = (taskCurrent + 1) | MUTEX_WAITERS;
+        mutexes[mutex].lockTime = DWT_CYCCNT_R;
+        mutexes[mutex].timed = true;
+        mutexes[mutex].stats.acquisitions++;
+    }
+    else
+    {
+        // otherwise, block the task, the waiters bit sends the owner's unlock to the kernel
+        IPC_PAGE->mutex[mutex] |= MUTEX_WAITERS;
+        countBlocked(&mutexes[mutex].stats);
+        tcb[taskCurrent].state = STATE_BLOCKED_MUTEX;
+        tcb[taskCurrent].mutex = mutex;
+        // add to mutex queue, it holds every task
+        mutexes[mutex].processQueue[mutexes[mutex].queueSize++] = taskCurrent;
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+// unlocks a mutex held by the current task, passing it to the next waiting task
+void unlockMutex(HANDLE handle)
+{
+    uint8_t mutex = mutexIndex(handle);
+    if (mutex == MAX_MUTEXES) return;
+
+    // only the locking task can unlock
+    if (mutexOwner(mutex) == taskCurrent)
+    {
+        releaseMutex(mutex);
+    }
+}
+
+// takes a semaphore like waitSemaphore, but gives up after timeout ticks (svc context)
+// the stacked r0 returns true once the semaphore is taken, false on a timeout or a stale handle
+void waitSemaphoreTimeout(HANDLE handle, uint32_t timeout, uint32_t *stacked)
+{
+    uint8_t semaphore = semaphoreIndex(handle);
+    stacked[0] = false;
+    if (semaphore == MAX_SEMAPHORES) return;
+    if (timeout == 0 && (IPC_PAGE->semaphore[semaphore] == 0 || (IPC_PAGE->semaphore[semaphore] & SEMAPHORE_WAITERS))) return;
+
+    stacked[0] = true;
+    waitSemaphore(handle);
+    if (tcb[taskCurrent].state == STATE_BLOCKED_SEMAPHORE)
+    {
+        tcb[taskCurrent].waitTimed = timeout != WAIT_FOREVER;
+        tcb[taskCurrent].ticks = timeout;
+        tcb[taskCurrent].svcFrame = stacked;
+    }
+}
+
+// locks a mutex like lockMutex, but gives up after timeout ticks (svc context)
+// the stacked r0 returns true once the mutex is held, false on a timeout or a stale handle
+void lockMutexTimeout(HANDLE handle, uint32_t timeout, uint32_t *stacked)
+{
+    uint8_t mutex = mutexIndex(handle);
+    stacked[0] = false;
+    if (mutex == MAX_MUTEXES) return;
+    if (timeout == 0 && mutexOwner(mutex) != MAX_TASKS) return;
+
+    stacked[0] = true;
+    lockMutex(handle);
+    if (tcb[taskCurrent].state == STATE_BLOCKED_MUTEX)
+    {
+        tcb[taskCurrent].waitTimed = timeout != WAIT_FOREVER;
+        tcb[taskCurrent].ticks = timeout;
+        tcb[taskCurrent].svcFrame = stacked;
+    }
+}
+
+// the timeout of a blocked task expired (systick), it leaves the wait list and its call returns 0 (false or NULL)
+void timeoutWait(uint8_t task)
+{
+    uint8_t i;
+    if (tcb[task].state == STATE_BLOCKED_SEMAPHORE)
+    {
+        i = tcb[task].semaphore;
+        removeWaiter(semaphores[i].processQueue, &semaphores[i].queueSize, task);
+        if (semaphores[i].queueSize == 0) IPC_PAGE->semaphore[i] = 0;
+    }
+    else if (tcb[task].state == STATE_BLOCKED_MUTEX)
+    {
+        // the waiters bit stays set, the owner's unlock just goes through the kernel
+        removeWaiter(mutexes[tcb[task].mutex].processQueue, &mutexes[tcb[task].mutex].queueSize, task);
+    }
+    else if (tcb[task].state == STATE_BLOCKED_QUEUE)
+    {
+        for (i = 0; i < MAX_QUEUES; i++)
+            removeWaiter(queues[i].processQueue, &queues[i].queueSize, task);
+    }
+    else if (tcb[task].state == STATE_BLOCKED_EVENT)
+        removeWaiter(eventGroups[tcb[task].eventGroup].processQueue, &eventGroups[tcb[task].eventGroup].queueSize, task);
+    tcb[task].svcFrame[0] = 0;
+    wakeTask(task);
+    if (preemption) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+}
+
+bool eventsMatch(uint32_t flags, uint32_t mask, uint8_t options)
+{
+    if (options & EVENT_WAIT_ALL) return (flags & mask) == mask;
+    return (flags & mask) != 0;
+}
+
+// sets event flags and releases every waiter whose mask is now satisfied, in the order they blocked
+// flags cleared on exit are only cleared after all waiters saw them, returns the flags left set
+uint32_t setEventFlags(HANDLE handle, uint32_t bits)
+{
+    uint8_t group = eventGroupIndex(handle);
+    uint32_t clear = 0;
+    uint8_t i, j, task;
+    bool woke = false;
+    if (group == MAX_EVENT_GROUPS) return 0;
+
+    eventGroups[group].flags |= bits;
+    for (i = 0, j = 0; i < eventGroups[group].queueSize; i++)
+    {
+        task = eventGroups[group].processQueue[i];
+        if (eventsMatch(eventGroups[group].flags, tcb[task].eventMask, tcb[task].eventOptions))
+        {
+            tcb[task].svcFrame[0] = eventGroups[group].flags; // return value of waitEvents
+            if (tcb[task].eventOptions & EVENT_CLEAR) clear |= tcb[task].eventMask;
+            wakeTask(task);
+            woke = true;
+        }
+        else
+        {
+            eventGroups[group].processQueue[j++] = task;
+        }
+    }
+    eventGroups[group].queueSize = j;
+    eventGroups[group].flags &= ~clear;
+    if (woke && preemption) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    return eventGroups[group].flags;
+}
+
+// returns the flags left set
+uint32_t clearEventFlags(HANDLE handle, uint32_t bits)
+{
+    uint8_t group = eventGroupIndex(handle);
+    if (group == MAX_EVENT_GROUPS) return 0;
+    eventGroups[group].flags &= ~bits;
+    return eventGroups[group].flags;
+}
+
+// returns the flags through the stacked r0 if the mask is already satisfied, otherwise blocks the current task
+// until setEventFlags satisfies it or the timeout (ticks) expires, a timeout of 0 only polls (svc context)
+void waitEventFlags(HANDLE handle, uint32_t mask, uint8_t options, uint32_t timeout, uint32_t *stacked)
+{
+    uint8_t group = eventGroupIndex(handle);
+    stacked[0] = 0;
+    if (group == MAX_EVENT_GROUPS || mask == 0) return;
+
+    if (eventsMatch(eventGroups[group].flags, mask, options))
+    {
+        stacked[0] = eventGroups[group].flags;
+        if (options & EVENT_CLEAR) eventGroups[group].flags &= ~mask;
+    }
+    else if (timeout > 0 && eventGroups[group].queueSize < MAX_EVENT_WAITERS)
+    {
+        eventGroups[group].processQueue[eventGroups[group].queueSize++] = taskCurrent;
+        tcb[taskCurrent].eventGroup = group;
+        tcb[taskCurrent].eventMask = mask;
+        tcb[taskCurrent].eventOptions = options;
+        tcb[taskCurrent].waitTimed = timeout != WAIT_FOREVER;
+        tcb[taskCurrent].ticks = timeout;
+        tcb[taskCurrent].svcFrame = stacked;
+        tcb[taskCurrent].state = STATE_BLOCKED_EVENT;
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+// updates the notification word of a task and wakes it if it is blocked in waitNotify (kernel side of notify)
+// no kernel object is involved, so this is cheaper than posting a semaphore
+bool notifyTask(uint8_t task, uint32_t value, uint8_t action)
+{
+    if (task >= MAX_TASKS || tcb[task].state == STATE_INVALID || tcb[task].state == STATE_KILLED) return false;
+    if (action == NOTIFY_SET_BITS)
+        tcb[task].notifyValue |= value;
+    else if (action == NOTIFY_INCREMENT)
+        tcb[task].notifyValue++;
+    else
+        tcb[task].notifyValue = value;
+    tcb[task].notifyPending = true;
+
+    if (tcb[task].state == STATE_BLOCKED_NOTIFY)
+    {
+        tcb[task].svcFrame[0] = tcb[task].notifyValue; // return value of waitNotify
+        tcb[task].notifyValue &= ~tcb[task].notifyClear;
+        tcb[task].notifyPending = false;
+        wakeTask(task);
+        if (preemption) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+    return true;
+}
+
+// returns the notification word through the stacked r0 and clears the mask bits if the current task has been notified,
+// otherwise blocks it until notifyTask or the timeout (ticks), a timeout of 0 only polls (svc context)
+void waitNotification(uint32_t mask, uint32_t timeout, uint32_t *stacked)
+{
+    stacked[0] = 0;
+    if (tcb[taskCurrent].notifyPending)
+    {
+        stacked[0] = tcb[taskCurrent].notifyValue;
+        tcb[taskCurrent].notifyValue &= ~mask;
+        tcb[taskCurrent].notifyPending = false;
+    }
+    else if (timeout > 0)
+    {
+        tcb[taskCurrent].notifyClear = mask;
+        tcb[taskCurrent].waitTimed = timeout != WAIT_FOREVER;
+        tcb[taskCurrent].ticks = timeout;
+        tcb[taskCurrent].svcFrame = stacked;
+        tcb[taskCurrent].state = STATE_BLOCKED_NOTIFY;
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+// kernel paths of wait/post/lock/unlock, exported so lockbench can time them against the fast paths
+void semaphoreWait(HANDLE semaphore)
+{
+    __asm("    SVC #13");
+}
+
+void semaphorePost(HANDLE semaphore)
+{
+    __asm("    SVC #14");
+}
+
+void mutexLock(HANDLE mutex)
+{
+    __asm("    SVC #15");
+}
+
+bool semaphoreWaitTimeout(HANDLE semaphore, uint32_t timeout);
+bool mutexLockTimeout(HANDLE mutex, uint32_t timeout);
 
-//-----------------------------------------------------------------------------
-// Subroutines
-//-----------------------------------------------------------------------------
+void mutexUnlock(HANDLE mutex)
+{
+    __asm("    SVC #16");
+}
 
-bool initMutex(uint8_t mutex)
+// wait, lock and unlock need a task to block or to own the mutex, and their kernel path is an svc, which is a
+// hard fault from handler mode, so an isr (or main) calling them gets an error logged instead, true if so
+bool refuseOutsideTask(HANDLE handle)
 {
-    bool ok = (mutex < MAX_MUTEXES);
-    if (ok)
+    if (calledFromTask()) return false;
+    writeLog(LOG_NOT_FROM_TASK, handle, getIpsr() & 0x1FF);
+    return true;
+}
+
+// REQUIRED: modify this function to wait a semaphore using pendsv
+// takes a free count without entering the kernel, the kernel blocks the task when the count is 0
+// an error outside a task (see refuseOutsideTask)
+void wait(HANDLE semaphore)
+{
+    uint8_t i = HANDLE_INDEX(semaphore);
+    uint32_t value;
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_SEMAPHORES)
     {
-        mutexes[mutex].lock = false;
-        mutexes[mutex].lockedBy = 0;
+        do
+        {
+            value = IPC_PAGE->semaphore[i];
+            if ((int32_t)value <= 0 || IPC_PAGE->semaphoreGeneration[i] != HANDLE_GENERATION(semaphore))
+            {
+                semaphoreWait(semaphore);
+                return;
+            }
+        } while (!compareAndSwap(&IPC_PAGE->semaphore[i], value, value - 1));
+        atomicAdd(&IPC_PAGE->acquired[i], 1);
+        return;
     }
-    return ok;
+    if (refuseOutsideTask(semaphore)) return;
+    semaphoreWait(semaphore);
 }
 
-bool initSemaphore(uint8_t semaphore, uint8_t count)
+// REQUIRED: modify this function to signal a semaphore is available using pendsv
+// adds to the count without entering the kernel unless a task is waiting
+// outside a task (an isr or main) it goes through postFromIsr, an svc from handler mode would be a hard fault
+void post(HANDLE semaphore)
 {
-    bool ok = (semaphore < MAX_SEMAPHORES);
+    uint8_t i = HANDLE_INDEX(semaphore);
+    uint32_t value;
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_SEMAPHORES)
     {
-        semaphores[semaphore].count = count;
+        do
+        {
+            value = IPC_PAGE->semaphore[i];
+            if ((value & SEMAPHORE_WAITERS) || IPC_PAGE->semaphoreGeneration[i] != HANDLE_GENERATION(semaphore))
+            {
+                semaphorePost(semaphore);
+                return;
+            }
+        } while (!compareAndSwap(&IPC_PAGE->semaphore[i], value, value + 1));
+        return;
     }
-    return ok;
+    if (!calledFromTask())
+    {
+        postFromIsr(semaphore);
+        return;
+    }
+    semaphorePost(semaphore);
 }
 
-// REQUIRED: initialize systick for 1ms system timer
-void initRtos(void)
+// REQUIRED: modify this function to lock a mutex using pendsv
+// a free mutex is taken without entering the kernel, the kernel queues the task otherwise
+// an error outside a task (see refuseOutsideTask)
+void lock(HANDLE mutex)
 {
-    uint8_t i;
-    // no tasks running
-    taskCount = 0;
-    // clear out tcb records
-    for (i = 0; i < MAX_TASKS; i++)
+    uint8_t i = HANDLE_INDEX(mutex);
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_MUTEXES && IPC_PAGE->mutexGeneration[i] == HANDLE_GENERATION(mutex)
+        && compareAndSwap(&IPC_PAGE->mutex[i], 0, IPC_PAGE->current + 1))
     {
-        tcb[i].state = STATE_INVALID;
-        tcb[i].pid = 0;
+        atomicAdd(&IPC_PAGE->acquired[MAX_SEMAPHORES + i], 1);
+        return;
     }
+    if (refuseOutsideTask(mutex)) return;
+    mutexLock(mutex);
 }
 
-// REQUIRED: Implement prioritization to NUM_PRIORITIES
-// loop through tcb and return index of next task to run
-uint8_t rtosScheduler(void)
+// wait() that gives up after timeout ticks (0 polls, WAIT_FOREVER never gives up)
+// returns true once the semaphore is taken, false on a timeout or outside a task, the fast path is the same as wait()
+bool waitTimeout(HANDLE semaphore, uint32_t timeout)
 {
-    if (priorityScheduler)
+    uint8_t i = HANDLE_INDEX(semaphore);
+    uint32_t value;
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_SEMAPHORES)
     {
-        // priority based scheduling
-        uint8_t highestPriority = 8; // higher than max
-        uint8_t selectedTask = 0xFF; // invalid
-        // find highest priority ready task
-        int i;
-        for (i = 0; i < taskCount; i++)
+        do
         {
-            if ((tcb[i].state == STATE_READY || tcb[i].state == STATE_UNRUN) && (tcb[i].priority < highestPriority))
-            {
-                highestPriority = tcb[i].priority;
-                selectedTask = i;
-            }
-        }
-        taskCurrent = selectedTask;
-        return selectedTask;
+            value = IPC_PAGE->semaphore[i];
+            if ((int32_t)value <= 0 || IPC_PAGE->semaphoreGeneration[i] != HANDLE_GENERATION(semaphore))
+                return semaphoreWaitTimeout(semaphore, timeout);
+        } while (!compareAndSwap(&IPC_PAGE->semaphore[i], value, value - 1));
+        atomicAdd(&IPC_PAGE->acquired[i], 1);
+        return true;
     }
-    else
+    if (refuseOutsideTask(semaphore)) return false;
+    return semaphoreWaitTimeout(semaphore, timeout);
+}
+
+// lock() that gives up after timeout ticks, returns true once the mutex is held, false on a timeout or outside a task
+bool lockTimeout(HANDLE mutex, uint32_t timeout)
+{
+    uint8_t i = HANDLE_INDEX(mutex);
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_MUTEXES && IPC_PAGE->mutexGeneration[i] == HANDLE_GENERATION(mutex)
+        && compareAndSwap(&IPC_PAGE->mutex[i], 0, IPC_PAGE->current + 1))
     {
-        // round robin scheduling
-        bool ok = false;
-        uint8_t task = taskCurrent; // start searching from next task
-        while (!ok)
-        {
-            task++;
-            if (task >= taskCount) task = 0;
-            ok = (tcb[task].state == STATE_READY || tcb[task].state == STATE_UNRUN);
-        }
-        taskCurrent = task;
-        return task;
+        atomicAdd(&IPC_PAGE->acquired[MAX_SEMAPHORES + i], 1);
+        return true;
     }
+    if (refuseOutsideTask(mutex)) return false;
+    return mutexLockTimeout(mutex, timeout);
 }
 
-// REQUIRED: modify this function to start the operating system
-// by calling scheduler, set srd bits, setting PSP, ASP bit, call fn with fn add in R0
-// fn set TMPL bit, and PC <= fn
-void startRtos(void)
+// REQUIRED: modify this function to unlock a mutex using pendsv
+// the kernel is only entered to hand the mutex to a waiting task
+// an error outside a task (see refuseOutsideTask)
+void unlock(HANDLE mutex)
 {
-    uint8_t task = rtosScheduler();
-    // set srd bits
-    applySramAccessMask(tcb[task].srd);
-
-    putsUart0("First task PSP = ");
-    putsUart0(inttohex((uint32_t)tcb[task].sp));
-    putcUart0('\n');
+    uint8_t i = HANDLE_INDEX(mutex);
+    if (FAST_IPC_PATHS && calledFromTask() && i < MAX_MUTEXES && IPC_PAGE->mutexGeneration[i] == HANDLE_GENERATION(mutex)
+        && compareAndSwap(&IPC_PAGE->mutex[i], IPC_PAGE->current + 1, 0))
+        return;
+    if (refuseOutsideTask(mutex)) return;
+    mutexUnlock(mutex);
+}
 
-    // set PSP
-    setPsp(tcb[task].sp);
-    printStack(tcb[task].sp);
+// sets flags in an event group, waking the tasks whose masks are satisfied, returns the flags left set
+uint32_t setEvents(HANDLE group, uint32_t bits);
+uint32_t clearEvents(HANDLE group, uint32_t bits);
 
-    // set ASP bit
-    setAspOn();
+// waits for any (EVENT_WAIT_ANY) or all (EVENT_WAIT_ALL) of the bits in mask, EVENT_CLEAR clears them on return
+// returns the flags that satisfied the wait, or 0 if timeout ticks passed first (0 polls, WAIT_FOREVER never gives up)
+uint32_t waitEvents(HANDLE group, uint32_t mask, uint8_t options, uint32_t timeout);
 
-    // jump to thread
-    _fn entry = (_fn)tcb[task].pid;
-    setPrivOff();
-    entry();              // jump to task; never returns
+// updates the notification word of a task (see NOTIFY_ actions), false if the task is not running
+bool notify(_fn fn, uint32_t value, uint8_t action);
 
-    // TODO: ?
-    // call fn with fn add in R0
-    // fn set TMPL bit
-    // and PC <= fn
-}
+// waits until the calling task is notified and returns its notification word, clearing the mask bits
+// returns 0 if timeout ticks passed first (0 polls, WAIT_FOREVER never gives up)
+uint32_t waitNotify(uint32_t mask, uint32_t timeout);
 
-// REQUIRED:
-// add task if room in task list
-// store the thread name
-// allocate stack space and store top of stack in sp and spInit
-// set the srd bits based on the memory allocation
-bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes)
+// sends the heap allocation msg (owned by task from) to a queue without copying it
+// a waiting receiver gets the blocks and the pointer in r0 directly, otherwise the kernel holds them
+bool sendMessage(uint8_t queue, void *msg, uint8_t from)
 {
-    bool ok = false;
-    uint8_t i = 0;
-    bool found = false;
-    if (taskCount < MAX_TASKS)
+    if (queues[queue].queueSize > 0)
     {
-        // make sure fn not already in list (prevent redundancy)
-        while (!found && (i < taskCount))
+        uint8_t nextTask = queues[queue].processQueue[0];
+        if (!transferHeap(msg, from, nextTask)) return false;
+        // shift queue
+        uint8_t i;
+        for (i = 1; i < queues[queue].queueSize; i++)
         {
-            found = (tcb[i].pid == fn);
-            i++;
+            queues[queue].processQueue[i - 1] = queues[queue].processQueue[i];
         }
-        if (!found)
-        {
-            // find first available tcb record
-            i = 0;
-            while (tcb[i].state != STATE_INVALID) {i++;}
-            taskCurrent = i;
-            tcb[i].state = STATE_UNRUN;
-            tcb[i].pid = fn;
-            tcb[i].priority = priority;
-            // copy name
-            uint8_t j;
-            for (j = 0; j < 15 && name[j] != 0; j++)
-            {
-                tcb[i].name[j] = name[j];
-            }
-
-            uint32_t *sp = (uint32_t *)mallocHeap(stackBytes); // top of block allocated
-
-            // tcb[i].srd applied inside malloc(addSramAccessWindow)
-            // make hw stack frame for first run
-            *(--sp) = 0x01000000;               // xPSR
-            *(--sp) = (uint32_t)fn;             // PC
-            *(--sp) = 0;                        // LR
-            *(--sp) = 0;                        // R12
-            *(--sp) = 0;                        // R3
-            *(--sp) = 0;                        // R2
-            *(--sp) = 0;                        // R1
-            *(--sp) = 0;                        // R0
-            printStack(sp);
-            tcb[i].sp = (void *) sp; // pointer to spot R0 is in
+        queues[queue].queueSize--;
+        tcb[nextTask].svcFrame[0] = (uint32_t)msg; // return value of queueReceive
+        wakeTask(nextTask);
+    }
+    else
+    {
+        if (queues[queue].count >= MAX_QUEUE_SIZE || !transferHeap(msg, from, MAX_TASKS)) return false;
+        queues[queue].messages[(queues[queue].head + queues[queue].count) % MAX_QUEUE_SIZE] = msg;
+        queues[queue].count++;
+    }
+    return true;
+}
 
-            taskCount++;
-            ok = true;
-        }
+// takes the oldest queued message and gives its blocks to task, returns NULL if the queue is empty
+void *takeMessage(uint8_t queue, uint8_t task)
+{
+    void *msg = NULL;
+    if (queues[queue].count > 0)
+    {
+        msg = queues[queue].messages[queues[queue].head];
+        queues[queue].head = (queues[queue].head + 1) % MAX_QUEUE_SIZE;
+        queues[queue].count--;
+        transferHeap(msg, MAX_TASKS, task);
     }
-    return ok;
+    return msg;
 }
 
-// REQUIRED: modify this function to kill a thread
-// REQUIRED: free memory, reMOVe any pending semaphore waiting,
-//           unlock any mutexes, mark state as killed
-void killThread(_fn fn)
+// returns the oldest message through the stacked r0, or blocks the current task until sendMessage hands one over
+// or timeout ticks pass, NULL on a timeout or a bad queue (svc context)
+void receiveMessage(uint8_t queue, uint32_t timeout, uint32_t *stacked)
 {
+    stacked[0] = 0;
+    if (queue >= MAX_QUEUES) return;
+    if (queues[queue].count > 0)
+    {
+        stacked[0] = (uint32_t)takeMessage(queue, taskCurrent);
+        loadMpuImage(tcb[taskCurrent].mpuImage);
+    }
+    else if (timeout > 0 && queues[queue].queueSize < MAX_QUEUE_WAITERS)
+    {
+        // block until sendMessage hands over a message through the stacked r0
+        queues[queue].processQueue[queues[queue].queueSize++] = taskCurrent;
+        tcb[taskCurrent].waitTimed = timeout != WAIT_FOREVER;
+        tcb[taskCurrent].ticks = timeout;
+        tcb[taskCurrent].svcFrame = stacked;
+        tcb[taskCurrent].state = STATE_BLOCKED_QUEUE;
+        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    }
 }
 
-// REQUIRED: modify this function to restart a thread, including creating a stack
-void restartThread(_fn fn)
+// adds a request to the isr ring, the mask only covers the ring so the most urgent isrs are never held off
+// requests are applied by pendsv with preemption on, or by the next tick
+// data (value bytes) is copied into the ring for ISR_QUEUE_SEND, NULL for the other requests
+bool requestFromIsr(uint8_t type, uint16_t target, uint32_t value, const uint8_t data[])
 {
+    uint32_t basepri = raiseBasepri(PRIORITY_BYTE(ISR_API_PRIORITY));
+    uint8_t next = (isrIn + 1) & (MAX_ISR_REQUESTS - 1);
+    uint8_t i;
+    bool ok = next != isrOut;
+    if (ok)
+    {
+        isrRequests[isrIn].type = type;
+        isrRequests[isrIn].target = target;
+        isrRequests[isrIn].value = value;
+        for (i = 0; data != NULL && i < value; i++)
+            isrRequests[isrIn].data[i] = data[i];
+        isrIn = next;
+    }
+    else if (isrDropped < 0xFFFF)
+    {
+        isrDropped++;
+    }
+    restoreBasepri(basepri);
+    if (ok && preemption) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+    return ok;
 }
 
-// REQUIRED: modify this function to set a thread priority
-void setThreadPriority(_fn fn, uint8_t priority)
+// posts a semaphore from an isr at ISR_API_PRIORITY or below, false if the request ring is full
+bool postFromIsr(HANDLE semaphore)
 {
+    return requestFromIsr(ISR_POST, semaphore, 0, NULL);
 }
 
-// REQUIRED: modify this function to yield execution back to scheduler using pendsv
-// kernel will switch tasks while saveing the context necessary for the resuming later
-void yield(void)
+// sets event flags from an isr at ISR_API_PRIORITY or below, false if the request ring is full
+bool setEventsFromIsr(HANDLE group, uint32_t bits)
 {
-    // thread is unprivileged, so svc is needed to call pendsv (only available in priv mode)
-    // svc pushes the task registers onto the PSP for context saving
-    __asm("    SVC #0");
+    return requestFromIsr(ISR_EVENT_SET, group, bits, NULL);
 }
 
-// REQUIRED: modify this function to support 1ms system timer
-// execution yielded back to scheduler until time elapses using pendsv
-void sleep(uint32_t tick)
+// notifies a task from an isr at ISR_API_PRIORITY or below, false if task is out of range or the ring is full
+// task is its tcb index, looked up once with findTask when the isr is set up (not a tcb scan in the isr),
+// notifyTask checks the task still exists when the request is applied
+bool notifyFromIsr(uint8_t task, uint32_t value, uint8_t action)
 {
-    __asm("    SVC #1");
+    if (task >= MAX_TASKS) return false;
+    return requestFromIsr(ISR_NOTIFY, task | (action << 8), value, NULL);
 }
 
-// REQUIRED: modify this function to wait a semaphore using pendsv
-void wait(int8_t semaphore)
+// sends size bytes (up to ISR_MESSAGE_SIZE) to a queue from an isr, false if size is too big or the ring is full
+// the heap is not safe to use from an isr, so the bytes are copied into the ring and runIsrRequests puts them
+// in a heap message, the receiver finds them just below the message pointer (msg - size)
+bool queueSendFromIsr(uint8_t queue, const void *data, uint8_t size)
 {
-    // if semaphore is available, decrement count
-    if (semaphores[semaphore].count > 0)
-    {
-        semaphores[semaphore].count--;
-    }
-    else
-    {
-        // otherwise, block the task
-        tcb[taskCurrent].state = STATE_BLOCKED_SEMAPHORE;
-        tcb[taskCurrent].semaphore = semaphore;
-        // add to semaphore queue if room available
-        uint8_t qSize = semaphores[semaphore].queueSize;
-        if (qSize < MAX_SEMAPHORE_QUEUE_SIZE)
-        {
-            semaphores[semaphore].processQueue[qSize] = taskCurrent;
-            semaphores[semaphore].queueSize++;
-        }
-    }
+    if (size > ISR_MESSAGE_SIZE) return false;
+    return requestFromIsr(ISR_QUEUE_SEND, queue, size, (const uint8_t *)data);
 }
 
-// REQUIRED: modify this function to signal a semaphore is available using pendsv
-void post(int8_t semaphore)
+// applies the requests isrs left in the ring (pendsv and systick, at KERNEL_PRIORITY)
+void runIsrRequests(void)
 {
-    // if queue is not empty, give to next task
-    if (semaphores[semaphore].queueSize > 0)
+    ISR_REQUEST request;
+    uint32_t basepri;
+    uint16_t dropped;
+    char *buffer;
+    char *msg;
+    uint8_t i;
+
+    while (isrOut != isrIn)
     {
-        uint8_t nextTask = semaphores[semaphore].processQueue[0];
-        // shift queue
-        uint8_t i;
-        for (i = 1; i < semaphores[semaphore].queueSize; i++)
+        request = isrRequests[isrOut];
+        isrOut = (isrOut + 1) & (MAX_ISR_REQUESTS - 1);
+        switch (request.type)
         {
-            semaphores[semaphore].processQueue[i - 1] = semaphores[semaphore].processQueue[i];
+            case ISR_POST:
+                signalSemaphore(request.target);
+                break;
+            case ISR_QUEUE_SEND:
+                // one kernel owned block, handed over like a message from a task
+                buffer = (request.target < MAX_QUEUES) ? allocKernelBuffer(ISR_MESSAGE_SIZE) : NULL;
+                if (buffer != NULL)
+                {
+                    msg = buffer + BLOCK_SIZE;
+                    for (i = 0; i < request.value; i++)
+                        (msg - request.value)[i] = request.data[i];
+                    if (sendMessage(request.target, msg, MAX_TASKS)) break;
+                    freeKernelBuffer(buffer);
+                }
+                writeLog(LOG_ISR_MESSAGE_LOST, request.target, request.value);
+                break;
+            case ISR_EVENT_SET:
+                setEventFlags(request.target, request.value);
+                break;
+            case ISR_NOTIFY:
+                notifyTask(request.target & 0xFF, request.value, request.target >> 8);
+                break;
         }
-        semaphores[semaphore].queueSize--;
-        tcb[nextTask].state = STATE_READY;
     }
-    else
+
+    if (isrDropped)
     {
-        semaphores[semaphore].count++;
+        basepri = raiseBasepri(PRIORITY_BYTE(ISR_API_PRIORITY));
+        dropped = isrDropped;
+        isrDropped = 0;
+        restoreBasepri(basepri);
+        writeLog(LOG_ISR_DROPPED, dropped, 0);
     }
 }
 
-// REQUIRED: modify this function to lock a mutex using pendsv
-void lock(int8_t mutex)
+// copies n bytes (multiple of 4) word by word, stands in for the copies a copy based queue has to make
+void copyWords(uint32_t *dst, const uint32_t *src, uint32_t n)
 {
-    // if mutex is available, lock it
-    if (!mutexes[mutex].lock)
-    {
-        mutexes[mutex].lock = true;
-        mutexes[mutex].lockedBy = taskCurrent;
-    }
-    else
+    for (n /= 4; n > 0; n--)
     {
-        // otherwise, block the task
-        tcb[taskCurrent].state = STATE_BLOCKED_MUTEX;
-        tcb[taskCurrent].mutex = mutex;
-        // add to mutex queue if room available
-        uint8_t qSize = mutexes[mutex].queueSize;
-        if (qSize < MAX_MUTEX_QUEUE_SIZE)
-        {
-            mutexes[mutex].processQueue[qSize] = taskCurrent;
-            mutexes[mutex].queueSize++;
-        }
+        *dst++ = *src++;
     }
 }
 
-// REQUIRED: modify this function to unlock a mutex using pendsv
-void unlock(int8_t mutex)
+// times passing a message through a queue by ownership transfer against copying it into a kernel buffer and
+// back out, which is what a copy based queue needs when tasks cannot see each other's memory
+// both ends of the queue are the calling task, so only the per message cost of the kernel is measured
+uint8_t runQueueBenchmark(QUEUE_BENCH result[])
 {
-    // only the locking task can unlock
-    if (mutexes[mutex].lockedBy == taskCurrent)
+    static const uint32_t sizes[QBENCH_SIZES] = {64, 1024, 4096};
+    uint8_t i, r;
+    uint32_t start;
+
+    for (i = 0; i < QBENCH_SIZES; i++)
     {
-        // if queue is not empty, give to next task
-        if (mutexes[mutex].queueSize > 0)
+        result[i].bytes = sizes[i];
+        result[i].zeroCopyCycles = 0;
+        result[i].copyCycles = 0;
+
+        uint8_t *msg = mallocHeap(sizes[i]);
+        uint8_t *kernelBuffer = mallocHeap(sizes[i]);
+        uint8_t *rxBuffer = mallocHeap(sizes[i]);
+        if (msg != NULL && kernelBuffer != NULL && rxBuffer != NULL)
         {
-            uint8_t nextTask = mutexes[mutex].processQueue[0];
-            // shift queue
-            uint8_t i;
-            for (i = 1; i < mutexes[mutex].queueSize; i++)
+            initQueue(BENCH_QUEUE);
+            start = DWT_CYCCNT_R;
+            for (r = 0; r < QBENCH_ROUNDS; r++)
             {
-                mutexes[mutex].processQueue[i - 1] = mutexes[mutex].processQueue[i];
+                sendMessage(BENCH_QUEUE, msg, taskCurrent);
+                takeMessage(BENCH_QUEUE, taskCurrent);
             }
-            mutexes[mutex].queueSize--;
-            // give mutex to next task
-            mutexes[mutex].lockedBy = nextTask;
-            tcb[nextTask].state = STATE_READY;
-        }
-        else
-        {
-            // no one waiting, just unlock
-            mutexes[mutex].lock = false;
-            mutexes[mutex].lockedBy = 0;
+            result[i].zeroCopyCycles = (DWT_CYCCNT_R - start) / QBENCH_ROUNDS;
+
+            start = DWT_CYCCNT_R;
+            for (r = 0; r < QBENCH_ROUNDS; r++)
+            {
+                copyWords((uint32_t *)(kernelBuffer - sizes[i]), (uint32_t *)(msg - sizes[i]), sizes[i]);
+                copyWords((uint32_t *)(rxBuffer - sizes[i]), (uint32_t *)(kernelBuffer - sizes[i]), sizes[i]);
+            }
+            result[i].copyCycles = (DWT_CYCCNT_R - start) / QBENCH_ROUNDS;
         }
+        freeHeap(msg);
+        freeHeap(kernelBuffer);
+        freeHeap(rxBuffer);
     }
+    return QBENCH_SIZES;
 }
 
 // REQUIRED: modify this function to add support for the system timer
 // REQUIRED: in preemptive code, add code to request task switch
 void systickIsr(void)
 {
+    // requests from isrs wait here at most a tick when preemption is off
+    runIsrRequests();
+
+    // sample the pc of the interrupted task (kernel handlers share this priority, so it is always thread code)
+    if (profileCount < profileSize)
+    {
+        uint32_t *psp = getPsp();
+        profileBuffer[profileCount++] = ((uint32_t)taskCurrent << PROFILE_TASK_SHIFT) | (psp[6] & PROFILE_PC_MASK);
+    }
+
+    // software timers only look at the first timer due
+    tickTimers();
+
     // with each tick passing, decrement ticks for delayed tasks to call back
     uint8_t i;
     for (i = 0; i < taskCount; i++)
@@ -407,9 +2027,20 @@ void systickIsr(void)
             tcb[i].ticks--;
             if (tcb[i].ticks == 0)
             {
-                tcb[i].state = STATE_READY;
+                // a restart after a fault runs from the start on a new stack, killed if there is no room for it
+                if (tcb[i].restartPending)
+                {
+                    tcb[i].restartPending = false;
+                    tcb[i].state = makeStack(i) ? STATE_UNRUN : STATE_KILLED;
+                }
+                else
+                    wakeTask(i);
             }
         }
+        else if (tcb[i].waitTimed && --tcb[i].ticks == 0)
+        {
+            timeoutWait(i);
+        }
     }
 }
 
@@ -426,34 +2057,72 @@ void systickIsr(void)
 
 void pendSvIsr(void)
 {
+    // requests from isrs first, this switch covers any task they wake
+    // pendsv is unpended before the ring is drained, so a request that lands during the drain pends it again
+    // the wakeups of the drain pend it too, that is cleared again while the ring is empty (under basepri, so
+    // a request cannot slip in between the check and the clear)
+    NVIC_INT_CTRL_R = NVIC_INT_CTRL_UNPEND_SV;
+    runIsrRequests();
+    uint32_t basepri = raiseBasepri(PRIORITY_BYTE(ISR_API_PRIORITY));
+    if (isrOut == isrIn) NVIC_INT_CTRL_R = NVIC_INT_CTRL_UNPEND_SV;
+    restoreBasepri(basepri);
+
     //putsUart0("inside pendSvIsr \n");
     // get stack pointer, has HW: r0-r3, r12, LR, PC, xPSR
     uint32_t *sp = getPsp();
 
+    // charge the cycles since the last dispatch (the switch itself goes to the next task)
+    uint32_t now = DWT_CYCCNT_R;
+    uint8_t previous = taskCurrent;
+    tcb[taskCurrent].cycles += now - dispatchTime;
+    dispatchTime = now;
+
 //    putsUart0("1. hw\n");
 //    printStack(sp);
 
-    // push r4-11 under stack
-    sp = pushSW(sp);
+    // r4-11 would land in the stack guard, catch it here instead of faulting inside pendsv
+    if (tcb[taskCurrent].guarded && ((uint32_t)sp - 32) < ((uint32_t)tcb[taskCurrent].stackBase + STACK_GUARD_BYTES))
+    {
+        writeLog(LOG_STACK_OVERFLOW, (uint32_t)sp, 0);
+        overflowTask(taskCurrent);
+    }
+
+    // a task that was killed or restarted while running has no context to save (its stack is freed)
+    if (tcb[taskCurrent].state != STATE_KILLED && tcb[taskCurrent].state != STATE_UNRUN && !tcb[taskCurrent].restartPending)
+    {
+        // push r4-11 under stack
+        sp = pushSW(sp);
 
-//    putsUart0("2. sw\n");
-//    printStack(sp);
+//        putsUart0("2. sw\n");
+//        printStack(sp);
 
-    // update the actual stack
-    setPsp(sp);
+        // update the actual stack
+        setPsp(sp);
 
-    // save the updated pointer
-    tcb[taskCurrent].sp = (void *) sp;
+        // save the updated pointer
+        tcb[taskCurrent].sp = (void *) sp;
 
-    // update state (not if blocked or delayed)
-    if (tcb[taskCurrent].state == STATE_UNRUN || tcb[taskCurrent].state == STATE_READY)
-    {
-        tcb[taskCurrent].state = STATE_READY;
+        // cheap high-water estimate, measureStack finds the exact value on demand
+        uint32_t used = (uint32_t)tcb[taskCurrent].stackBase + tcb[taskCurrent].stackAlloc - (uint32_t)sp;
+        if (used > tcb[taskCurrent].stackPeak) tcb[taskCurrent].stackPeak = used;
     }
 
     // get next task
     uint8_t task = rtosScheduler();
 
+    // a task that is still ready and did not yield was preempted
+    if (task != previous)
+    {
+        if (tcb[previous].state == STATE_READY && !yielding)
+            tcb[previous].involuntary++;
+        else
+            tcb[previous].voluntary++;
+    }
+    yielding = false;
+    if (tcb[task].woken) countLatency(task, DWT_CYCCNT_R);
+
+    IPC_PAGE->current = task;
+
     // psp for next stack
     sp = (uint32_t *) tcb[task].sp;
 
@@ -465,12 +2134,17 @@ void pendSvIsr(void)
         // set r4-11 from the stack
         sp = popSW(sp);
     }
+    else
+    {
+        // first run, the task is marked ready while it runs
+        tcb[task].state = STATE_READY;
+    }
 //    putsUart0("4. applied\n");
 //    printStack(sp);
     // if unrun the hw stack is made in createThread()
     tcb[task].sp = (void *) sp;
-    // set srd bits
-    applySramAccessMask(tcb[task].srd);
+    // set srd bits (image is rebuilt by the memory manager when allocations change)
+    loadMpuImage(tcb[task].mpuImage);
     // set PSP
     setPsp(tcb[task].sp);
 
@@ -495,16 +2169,280 @@ void svCallIsr(void)
 
     //putsUart0("svc number found is "); putsUart0(uitoa(svcNumber));
 
-    if (svcNumber == 0) // yield
-    {
-        NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV; // trigger pendsv
-    }
-    else if (svcNumber == 1) // sleep
+    uint8_t task;
+    uint8_t count;
+    STACK_INFO *info;
+
+    switch (svcNumber)
     {
-            //tcb[taskCurrent].ticks = (unit32_t) arg;
-            //tcb[taskCurrent].state = STATE_DELAYED;
-            // save context
-            // sth about systick
+        case SVC_YIELD:
+            yielding = true;
+            NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV; // trigger pendsv
+            break;
+        case SVC_SLEEP:
+            // systickIsr counts the ticks down and makes the task ready again
+            if (stacked[0] > 0)
+            {
+                tcb[taskCurrent].ticks = stacked[0];
+                tcb[taskCurrent].state = STATE_DELAYED;
+            }
+            else
+                yielding = true;
+            NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+            break;
+        case SVC_KILL:
+            task = findTask((_fn)arg);
+            if (task < MAX_TASKS && tcb[task].state != STATE_KILLED)
+            {
+                stopTask(task);
+                if (task == taskCurrent) NVIC_INT_CTRL_R = NVIC_INT_CTRL_PEND_SV;
+            }
+            break;
+        case SVC_RESTART:
+            task = findTask((_fn)arg);
+            if (task < MAX_TASKS && tcb[task].state == STATE_KILLED && makeStack(task))
+            {
+                tcb[task].faults = 0;
+                tcb[task].state = STATE_UNRUN;
+            }
+            break;
+        case SVC_STACKS:
+            stacked[0] = 0;
+            if (!taskCanAccess(taskCurrent, arg, MAX_TASKS * sizeof(STACK_INFO), true)) break;
+            info = (STACK_INFO *)arg;
+            count = 0;
+            for (task = 0; task < MAX_TASKS; task++)
+            {
+                if (tcb[task].state == STATE_INVALID || tcb[task].state == STATE_KILLED) continue;
+                uint8_t j;
+                for (j = 0; j < 16; j++)
+                {
+                    info[count].name[j] = tcb[task].name[j];
+                }
+                info[count].allocated = tcb[task].stackAlloc;
+                info[count].peak = measureStack(task);
+                count++;
+            }
+            stacked[0] = count; // return value in r0
+            break;
+        case SVC_QUEUE_SEND:
+            stacked[0] = (stacked[0] < MAX_QUEUES) && sendMessage(stacked[0], (void *)stacked[1], taskCurrent);
+            loadMpuImage(tcb[taskCurrent].mpuImage);   // sender loses access to the blocks
+            break;
+        case SVC_QUEUE_RECEIVE:
+            receiveMessage(stacked[0], WAIT_FOREVER, stacked);
+            break;
+        case SVC_QUEUE_RECEIVE_TIMEOUT:
+            receiveMessage(stacked[0], stacked[1], stacked);
+            break;
+        case SVC_TIMER_CREATE:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = newTimer((const char *)arg, (_fn)stacked[1], stacked[2], stacked[3]);
+            break;
+        case SVC_TIMER_DESTROY:
+            stacked[0] = deleteTimer(stacked[0]);
+            break;
+        case SVC_TIMER_START:
+            stacked[0] = armTimer(stacked[0], false);
+            break;
+        case SVC_TIMER_STOP:
+            stacked[0] = disarmTimer(stacked[0]);
+            break;
+        case SVC_TIMER_RESET:
+            stacked[0] = armTimer(stacked[0], true);
+            break;
+        case SVC_TIMER_FIND:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = lookupTimer((const char *)arg);
+            break;
+        case SVC_TIMER_EXPIRED:
+            stacked[0] = (uint32_t)takeExpiredTimer();
+            break;
+        case SVC_MALLOC:
+            stacked[0] = (uint32_t)mallocHeap(stacked[0]);
+            loadMpuImage(tcb[taskCurrent].mpuImage);
+            break;
+        case SVC_FREE:
+            freeHeap((void *)stacked[0]);
+            break;
+        case SVC_QBENCH:
+            if (!taskCanAccess(taskCurrent, arg, QBENCH_SIZES * sizeof(QUEUE_BENCH), true)) { stacked[0] = 0; break; }
+            stacked[0] = runQueueBenchmark((QUEUE_BENCH *)arg);
+            loadMpuImage(tcb[taskCurrent].mpuImage);
+            break;
+        case SVC_SHM_OPEN:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, SHARED_NAME_SIZE)) { stacked[0] = 0; break; }
+            stacked[0] = (uint32_t)mapShared((const char *)arg, stacked[1], taskCurrent, stacked[2]);
+            loadMpuImage(tcb[taskCurrent].mpuImage);
+            break;
+        case SVC_SHM_CLOSE:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, SHARED_NAME_SIZE)) break;
+            unmapShared((const char *)arg, taskCurrent);
+            loadMpuImage(tcb[taskCurrent].mpuImage);
+            break;
+        case SVC_SHM_INFO:
+            if (!taskCanAccess(taskCurrent, arg, (uint8_t)stacked[1] * sizeof(SHARED_INFO), true)) { stacked[0] = 0; break; }
+            stacked[0] = copySharedMaps((SHARED_INFO *)arg, stacked[1]);
+            break;
+        case SVC_WAIT:
+            waitSemaphore(stacked[0]);
+            break;
+        case SVC_POST:
+            signalSemaphore(stacked[0]);
+            break;
+        case SVC_LOCK:
+            lockMutex(stacked[0]);
+            break;
+        case SVC_WAIT_TIMEOUT:
+            waitSemaphoreTimeout(stacked[0], stacked[1], stacked);
+            break;
+        case SVC_LOCK_TIMEOUT:
+            lockMutexTimeout(stacked[0], stacked[1], stacked);
+            break;
+        case SVC_UNLOCK:
+            unlockMutex(stacked[0]);
+            break;
+        case SVC_SEMAPHORE_CREATE:
+            if (!taskCanReadString(taskCurrent, (const char *)stacked[1], IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = newSemaphore(stacked[0], (const char *)stacked[1]);
+            break;
+        case SVC_SEMAPHORE_DESTROY:
+            stacked[0] = deleteSemaphore(stacked[0]);
+            break;
+        case SVC_MUTEX_CREATE:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = newMutex((const char *)arg);
+            break;
+        case SVC_MUTEX_DESTROY:
+            stacked[0] = deleteMutex(stacked[0]);
+            break;
+        case SVC_SEMAPHORE_FIND:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = lookupIpc(IPC_SEMAPHORE, (const char *)arg);
+            break;
+        case SVC_MUTEX_FIND:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = lookupIpc(IPC_MUTEX, (const char *)arg);
+            break;
+        case SVC_UART_WRITE:
+            // copy what fits, block until the tx isr frees space if the string did not fit
+            if (!taskCanReadString(taskCurrent, (const char *)arg, 0xFFFFFFFF)) { stacked[0] = 0; break; }
+            stacked[0] = writeUart0Buffer((const char *)arg);
+            if (((const char *)arg)[stacked[0]] != 0) waitSemaphore(uartTxSpace);
+            break;
+        case SVC_UART_READ:
+            stacked[0] = rxLineReady() ? readUart0Buffer() : 0;
+            break;
+        case SVC_UART_KBHIT:
+            stacked[0] = rxLineReady();
+            break;
+        case SVC_UART_DMA:
+            // uDMA reads with the bus rights of the controller, not the task, so the buffer is checked here
+            // (endDump calls startUart0Dma directly for kernel buffers)
+            if (!taskCanAccess(taskCurrent, arg, (uint16_t)stacked[1], false)) { stacked[0] = false; break; }
+            stacked[0] = startUart0Dma((char *)arg, stacked[1], false);
+            break;
+        case SVC_LOG_WRITE:
+            writeLog((uint32_t)arg, stacked[1], stacked[2]);
+            break;
+        case SVC_LOG_READ:
+            if (!taskCanAccess(taskCurrent, arg, sizeof(LOG_ENTRY), true)
+                || !taskCanAccess(taskCurrent, (void *)stacked[1], 16, true)) { stacked[0] = false; break; }
+            stacked[0] = takeLog((LOG_ENTRY *)arg, (char *)stacked[1]);
+            break;
+        case SVC_UART_LINE:
+            // an empty buffer still gets its terminator
+            if (!taskCanAccess(taskCurrent, arg, (uint8_t)stacked[1] ? (uint8_t)stacked[1] : 1, true)) { stacked[0] = 0; break; }
+            stacked[0] = readUart0Line((char *)arg, stacked[1]);
+            break;
+        case SVC_COMMANDS:
+            if (!taskCanAccess(taskCurrent, arg, (uint8_t)stacked[1] * sizeof(SHELL_COMMAND *), true)) { stacked[0] = 0; break; }
+            stacked[0] = copyCommands((const SHELL_COMMAND **)arg, stacked[1]);
+            break;
+        case SVC_TASK_INFO:
+            if (!taskCanAccess(taskCurrent, arg, taskCount * sizeof(TASK_INFO), true)
+                || !taskCanAccess(taskCurrent, (void *)stacked[1], sizeof(uint32_t), true)) { stacked[0] = 0; break; }
+            stacked[0] = copyTaskInfo((TASK_INFO *)arg, (uint32_t *)stacked[1]);
+            break;
+        case SVC_IPC_INFO:
+            if (!taskCanAccess(taskCurrent, arg, MAX_IPC * sizeof(IPC_INFO), true)) { stacked[0] = 0; break; }
+            stacked[0] = copyIpcInfo((IPC_INFO *)arg);
+            break;
+        case SVC_IPC_RESET:
+            clearIpcStats();
+            break;
+        case SVC_LATENCY:
+            stacked[0] = 0;
+            if (!taskCanAccess(taskCurrent, arg, taskCount * sizeof(LATENCY_INFO), true)) break;
+            for (task = 0; task < taskCount; task++)
+            {
+                LATENCY_INFO *latency = (LATENCY_INFO *)arg + task;
+                uint8_t j;
+                for (j = 0; j < 16; j++)
+                    latency->name[j] = tcb[task].name[j];
+                latency->maxCycles = tcb[task].maxLatency;
+                for (j = 0; j < LATENCY_BUCKETS; j++)
+                    latency->bucket[j] = tcb[task].latency[j];
+            }
+            stacked[0] = taskCount;
+            break;
+        case SVC_PROFILE_START:
+            stacked[0] = beginProfile(stacked[0]);
+            break;
+        case SVC_PROFILE_STOP:
+            if (!taskCanAccess(taskCurrent, arg, sizeof(uint32_t *), true)
+                || !taskCanAccess(taskCurrent, (void *)stacked[1], sizeof(void *), true)) { stacked[0] = 0; break; }
+            stacked[0] = endProfile((uint32_t **)arg, (void **)stacked[1], taskCurrent);
+            loadMpuImage(tcb[taskCurrent].mpuImage);
+            break;
+        case SVC_CRASH:
+            if (!taskCanAccess(taskCurrent, arg, sizeof(CRASH_RECORD), true)) { stacked[0] = false; break; }
+            stacked[0] = copyCrash((CRASH_RECORD *)arg);
+            break;
+        case SVC_CRASH_CLEAR:
+            eraseCrash();
+            break;
+        case SVC_REBOOT:
+            resetSystem();
+            break;
+        case SVC_CYCLES:
+            stacked[0] = DWT_CYCCNT_R;
+            break;
+        case SVC_EVENT_CREATE:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = newEventGroup((const char *)arg);
+            break;
+        case SVC_EVENT_DESTROY:
+            stacked[0] = deleteEventGroup(stacked[0]);
+            break;
+        case SVC_EVENT_FIND:
+            if (!taskCanReadString(taskCurrent, (const char *)arg, IPC_NAME_SIZE)) { stacked[0] = NO_HANDLE; break; }
+            stacked[0] = lookupIpc(IPC_EVENT, (const char *)arg);
+            break;
+        case SVC_EVENT_SET:
+            stacked[0] = setEventFlags(stacked[0], stacked[1]);
+            break;
+        case SVC_EVENT_CLEAR:
+            stacked[0] = clearEventFlags(stacked[0], stacked[1]);
+            break;
+        case SVC_EVENT_WAIT:
+            waitEventFlags(stacked[0], stacked[1], stacked[2], stacked[3], stacked);
+            break;
+        case SVC_NOTIFY:
+            stacked[0] = notifyTask(findTask((_fn)arg), stacked[1], stacked[2]);
+            break;
+        case SVC_NOTIFY_WAIT:
+            waitNotification(stacked[0], stacked[1], stacked);
+            break;
+        case SVC_LATENCY_RESET:
+            for (task = 0; task < MAX_TASKS; task++)
+            {
+                uint8_t j;
+                tcb[task].maxLatency = 0;
+                for (j = 0; j < LATENCY_BUCKETS; j++)
+                    tcb[task].latency[j] = 0;
+            }
+            break;
     }
 }
 
@@ -512,46 +2450,57 @@ void svCallIsr(void)
 // name pid state sp srd priority
 void printTcb(void)
 {
-    putsUart0("Name: PID State SP SRD Priority\n");
+    beginDump(1024);
+    dumpStr("Name: PID State SP SRD Priority\n");
     uint8_t i;
     for (i = 0; i < taskCount; i++)
     {
-        putsUart0(tcb[i].name);
-        putsUart0(": ");
-        putsUart0(uitoa(tcb[i].pid));
-        putsUart0(" ");
+        dumpStr(tcb[i].name);
+        dumpStr(": ");
+        dumpStr(uitoa(tcb[i].pid));
+        dumpStr(" ");
         switch (tcb[i].state)
         {
             case STATE_INVALID:
-                putsUart0("invalid");
+                dumpStr("invalid");
                 break;
             case STATE_UNRUN:
-                putsUart0("unrun");
+                dumpStr("unrun");
                 break;
             case STATE_READY:
-                putsUart0("ready");
+                dumpStr("ready");
                 break;
             case STATE_DELAYED:
-                putsUart0("delayed");
+                dumpStr("delayed");
                 break;
             case STATE_BLOCKED_SEMAPHORE:
-                putsUart0("blocked by semaphore");
+                dumpStr("blocked by semaphore");
                 break;
             case STATE_BLOCKED_MUTEX:
-                putsUart0("blocked by mutex");
+                dumpStr("blocked by mutex");
                 break;
             case STATE_KILLED:
-                putsUart0("killed");
+                dumpStr("killed");
+                break;
+            case STATE_BLOCKED_QUEUE:
+                dumpStr("blocked by queue");
+                break;
+            case STATE_BLOCKED_EVENT:
+                dumpStr("blocked by event group");
+                break;
+            case STATE_BLOCKED_NOTIFY:
+                dumpStr("blocked by notify");
                 break;
         }
-        putsUart0(" ");
-        putsUart0(uitoa((uint32_t)tcb[i].sp));
-        putsUart0(" ");
-        putsUart0(uitoa(tcb[i].srd));
-        putsUart0(" ");
-        putsUart0(uitoa(tcb[i].priority));
-        putsUart0("\n");
+        dumpStr(" ");
+        dumpStr(uitoa((uint32_t)tcb[i].sp));
+        dumpStr(" ");
+        dumpStr(uitoa(tcb[i].srd));
+        dumpStr(" ");
+        dumpStr(uitoa(tcb[i].priority));
+        dumpStr("\n");
     }
+    endDump();
 }
 
 // check whats inside addresses
@@ -25,42 +25,325 @@
 // function pointer
 typedef void (*_fn)();
 
+// semaphore and mutex handles: pool index in bits 7-0, generation of the slot in bits 15-8
+// the generation changes each time a slot is reused, so a stale handle is rejected in O(1)
+typedef uint16_t HANDLE;
+#define NO_HANDLE 0
+#define MAKE_HANDLE(index, generation) ((HANDLE)(((generation) << 8) | (index)))
+#define HANDLE_INDEX(handle) ((handle) & 0xFF)
+#define HANDLE_GENERATION(handle) ((handle) >> 8)
+#define IPC_NAME_SIZE 12
+
+// lock-free fast paths of wait/post/lock/unlock (see IPC_PAGE in kernel.c), off by default
+// with 1 every task maps the page of semaphore counts and mutex owners and changes it without the kernel, so any
+// task can change any count or take or free any mutex in the name of another task: this gives up the isolation
+// between tasks for semaphores and mutexes, only use it when all tasks are trusted
+// with 0 the page is kernel memory and every call goes through the kernel
+#define FAST_IPC_PATHS 0
+
 // mutex
-#define MAX_MUTEXES 1
-#define MAX_MUTEX_QUEUE_SIZE 2
-#define resource 0
+#define MAX_MUTEXES 4
+#define MAX_MUTEX_QUEUE_SIZE MAX_TASKS          // a task waits on one object at a time, so every task fits
 
 // semaphore
-#define MAX_SEMAPHORES 3
-#define MAX_SEMAPHORE_QUEUE_SIZE 2
-#define keyPressed 0
-#define keyReleased 1
-#define flashReq 2
+#define MAX_SEMAPHORES 10
+#define MAX_SEMAPHORE_QUEUE_SIZE MAX_TASKS      // every task fits
+// kernel semaphores, made by initRtos in the first slots and never destroyed, so their handles are constant
+#define uartTxSpace MAKE_HANDLE(0, 1)   // posted by uart0Isr when tx buffer space frees up for a blocked writer
+#define uartRxLine  MAKE_HANDLE(1, 1)   // posted when enter completes a line in the rx buffer
+#define uartDmaDone MAKE_HANDLE(2, 1)   // posted when a task's writeUart0Dma transfer completes
+#define KERNEL_SEMAPHORES 3
+
+// event groups, 32 flag bits that tasks wait on with any-of or all-of masks
+#define MAX_EVENT_GROUPS 4
+#define MAX_EVENT_WAITERS 4
+#define EVENT_WAIT_ANY 0            // waitEvents returns when any bit of the mask is set
+#define EVENT_WAIT_ALL 1            // waitEvents returns when every bit of the mask is set
+#define EVENT_CLEAR    2            // the mask bits are cleared when the wait returns
+#define WAIT_FOREVER 0xFFFFFFFF     // timeout of a blocking call that never gives up (waitTimeout, waitEvents, ...)
+// kernel event groups, made by initRtos in the first slots
+#define buttonEvents MAKE_HANDLE(0, 1)  // set from buttonTimerIsr, debounced presses and releases (see buttons.h)
+#define KERNEL_EVENT_GROUPS 1
+
+// task notifications, a word in each tcb that one task or isr updates and its owner waits on
+#define NOTIFY_SET_BITS  0          // the value is ORed into the word
+#define NOTIFY_INCREMENT 1          // the word counts up by one, the value is ignored
+#define NOTIFY_OVERWRITE 2          // the word is replaced by the value
+
+// message queue
+#define MAX_QUEUES 2
+#define MAX_QUEUE_SIZE 4
+#define MAX_QUEUE_WAITERS 2
+
+// shared memory
+#define MAX_SHARED 4
+#define SHARED_NAME_SIZE 8
 
 // tasks
 #define MAX_TASKS 12
 
+// interrupt priorities (0 is the most urgent), the field is the top 3 bits of each priority byte
+// the kernel handlers and uart0Isr share KERNEL_PRIORITY, so they never interrupt each other
+// isrs from ISR_API_PRIORITY to KERNEL_PRIORITY - 1 preempt the kernel and may only use the FromIsr calls,
+// more urgent isrs are never masked by the kernel and must not call it
+#define KERNEL_PRIORITY  7
+#define ISR_API_PRIORITY 2
+#define PRIORITY_BYTE(priority) ((priority) << 5)
+
+// cycle counter (DWT), started by initCycleCounter, used for timestamps and benchmarks
+// the DWT is on the private peripheral bus, so only privileged code can read it (tasks use getCycles)
+#define DEMCR_R      (*((volatile uint32_t *)0xE000EDFC))
+#define DEMCR_TRCENA 0x01000000
+#define DWT_CTRL_R   (*((volatile uint32_t *)0xE0001000))
+#define DWT_CTRL_CYCCNTENA 0x00000001
+#define DWT_CYCCNT_R (*((volatile uint32_t *)0xE0001004))
+
+// requests from interrupts, applied by pendsv or the next tick
+#define MAX_ISR_REQUESTS 16      // power of 2
+#define ISR_MESSAGE_SIZE 8       // largest payload of queueSendFromIsr, copied through the ring
+
+// mpu image
+#define MPU_IMAGE_WORDS 12 // RBAR/RASR pair for each of the 4 SRAM regions, the read-only window and the stack guard
+
+// wakeup latency histogram, bucket i counts latencies of 2^(i+6) to 2^(i+7)-1 cycles (first and last are open)
+#define LATENCY_BUCKETS 16
+#define LATENCY_SHIFT 6
+
+// sampling profiler, one sample per systick: task index in bits 31-24, interrupted pc in bits 23-0
+#define PROFILE_MAX_SAMPLES 1024
+#define PROFILE_TASK_SHIFT 24
+#define PROFILE_PC_MASK 0x00FFFFFF
+
+// stack guard
+#define STACK_GUARD_BYTES 32 // no-access mpu region (7) at the bottom of each guarded stack
+
+// stack usage
+#define STACK_PAINT 0xC0FFEE55 // pattern written over new stacks to find the high-water mark
+
+// queue benchmark
+#define QBENCH_SIZES 3  // 64B, 1KiB and 4KiB messages
+#define QBENCH_ROUNDS 16
+
+typedef struct _QUEUE_BENCH
+{
+    uint32_t bytes;                // message size
+    uint32_t zeroCopyCycles;       // cycles per message passed by ownership transfer
+    uint32_t copyCycles;           // cycles per message copied in and out of a kernel buffer
+} QUEUE_BENCH;
+
+typedef struct _SHARED_INFO
+{
+    char name[SHARED_NAME_SIZE];
+    uint32_t base;
+    uint32_t size;
+    char task[16];                 // name of a task that maps the region
+    bool readOnly;                 // the task can only read the region
+} SHARED_INFO;
+
+typedef struct _STACK_INFO
+{
+    char name[16];
+    uint32_t allocated;            // bytes allocated for the stack (whole blocks)
+    uint32_t peak;                 // most bytes ever used
+} STACK_INFO;
+
+// thread created at boot by createThreads, tables of these are const so they stay in flash
+typedef struct _THREAD_DESC
+{
+    _fn fn;
+    const char *name;
+    uint8_t priority;
+    uint32_t stackBytes;
+    bool start;                    // UNRUN at boot, or KILLED with no stack until restarted
+} THREAD_DESC;
+
+// task snapshot for ps and top, counters wrap so rates come from the difference of two snapshots
+typedef struct _TASK_INFO
+{
+    char name[16];
+    void *pid;
+    const char *state;             // state name (flash)
+    char blockedOn[IPC_NAME_SIZE]; // name of the semaphore, mutex, queue or event group blocking the task, or empty
+    uint8_t priority;
+    uint32_t ticks;                // sleep ticks remaining
+    uint32_t cycles;               // cpu cycles used
+    uint32_t voluntary;            // switches away by yield, sleep or blocking
+    uint32_t involuntary;          // switches away while still ready (preempted)
+    uint32_t stackUsed;            // bytes in use at the last switch
+    uint32_t stackPeak;
+    uint32_t stackAlloc;
+    uint32_t heapBytes;            // heap owned besides the stack
+} TASK_INFO;
+
+// ipc snapshot for ipcs
+#define IPC_SEMAPHORE 0
+#define IPC_MUTEX     1
+#define IPC_QUEUE     2
+#define IPC_EVENT     3
+#define MAX_IPC_WAITERS MAX_TASKS  // largest of the semaphore, mutex, queue and event group wait lists
+#define MAX_IPC (MAX_SEMAPHORES + MAX_MUTEXES + MAX_QUEUES + MAX_EVENT_GROUPS)
+
+typedef struct _LATENCY_INFO
+{
+    char name[16];
+    uint32_t maxCycles;
+    uint16_t bucket[LATENCY_BUCKETS];
+} LATENCY_INFO;
+
+// contention counters of a semaphore or mutex, times are DWT cycles
+typedef struct _LOCK_STATS
+{
+    uint32_t acquisitions;
+    uint32_t contended;            // acquisitions that blocked first
+    uint64_t waitCycles;           // total time blocked
+    uint32_t maxWaitCycles;
+    uint64_t holdCycles;           // total time locked (mutexes)
+    uint32_t maxHoldCycles;
+} LOCK_STATS;
+
+typedef struct _IPC_INFO
+{
+    char name[IPC_NAME_SIZE];
+    HANDLE handle;                 // NO_HANDLE for queues
+    uint8_t type;
+    uint32_t value;                // semaphore count, mutex locked, messages queued or event flags
+    uint8_t owner;                 // task (tcb index) holding a mutex
+    uint8_t waiters;
+    uint8_t waiter[MAX_IPC_WAITERS]; // tasks (tcb index) in wake order
+    LOCK_STATS stats;              // zero for queues
+} IPC_INFO;
+
+// tcb
+struct _tcb
+{
+    uint8_t state;                 // see STATE_ values in kernel.c
+    void *pid;                     // used to uniquely identify thread (add of task fn)
+    void *sp;                      // current stack pointer
+    uint8_t priority;              // 0=highest
+    uint8_t currentPriority;       // 0=highest (needed for pi)
+    uint32_t ticks;                // ticks until sleep complete
+    uint64_t srd;                  // MPU subregion disable bits
+    uint32_t mpuImage[MPU_IMAGE_WORDS]; // encoded RBAR/RASR values for srd, loaded by pendSvIsr
+    void *stackBase;               // lowest address of the stack allocation
+    uint32_t stackBytes;           // requested stack size (used to recreate the stack)
+    uint32_t stackAlloc;           // bytes allocated for the stack (whole blocks)
+    uint32_t stackPeak;            // high-water mark in bytes, updated at each switch and by measureStack
+    bool guarded;                  // stack guard enabled for this task
+    uint32_t *svcFrame;            // stacked r0-xPSR of the service call the task is blocked in
+    char name[16];                 // name of task used in ps command
+    uint8_t mutex;                 // index of the mutex in use or blocking the thread
+    uint8_t semaphore;             // index of the semaphore that is blocking the thread
+    uint8_t eventGroup;            // index of the event group the thread waits on
+    uint32_t eventMask;            // bits it waits for
+    uint8_t eventOptions;          // EVENT_WAIT_ALL and EVENT_CLEAR
+    bool waitTimed;                // ticks counts down a timeout while blocked
+    uint32_t notifyValue;          // notification word, see NOTIFY_ actions
+    uint32_t notifyClear;          // bits cleared when the blocked waitNotify returns
+    bool notifyPending;            // notified since the last waitNotify returned
+    uint32_t cycles;               // cpu cycles used, charged by pendSvIsr
+    uint32_t voluntary;            // switches away by yield, sleep or blocking
+    uint32_t involuntary;          // switches away while ready
+    uint32_t waitStart;            // cycle count when the task blocked on a semaphore or mutex
+    bool woken;                    // made ready by a wakeup and not dispatched since
+    uint32_t readyTime;            // cycle count of that wakeup
+    uint32_t maxLatency;           // cycles from wakeup to dispatch
+    uint16_t latency[LATENCY_BUCKETS]; // log2 histogram of those latencies (saturating)
+    uint8_t faults;                // faults since created or restarted from the shell, sets the restart backoff
+    bool restartPending;           // DELAYED until a restart after a fault
+};
+
+extern struct _tcb tcb[MAX_TASKS];
+extern uint8_t taskCurrent;
+extern bool warmBoot;
+
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
-bool initMutex(uint8_t mutex);
-bool initSemaphore(uint8_t semaphore, uint8_t count);
+HANDLE newSemaphore(uint8_t count, const char name[]);
+HANDLE newMutex(const char name[]);
+bool deleteSemaphore(HANDLE handle);
+bool deleteMutex(HANDLE handle);
+HANDLE createSemaphore(uint8_t count, const char name[]);
+HANDLE createMutex(const char name[]);
+bool destroySemaphore(HANDLE handle);
+bool destroyMutex(HANDLE handle);
+HANDLE findSemaphore(const char name[]);
+HANDLE findMutex(const char name[]);
+HANDLE newEventGroup(const char name[]);
+bool deleteEventGroup(HANDLE handle);
+HANDLE createEventGroup(const char name[]);
+bool destroyEventGroup(HANDLE handle);
+HANDLE findEventGroup(const char name[]);
+void copyIpcName(char dst[], const char src[]);
+bool sameIpcName(const char objectName[], const char name[]);
+uint8_t nextGeneration(uint8_t generation);
+bool initQueue(uint8_t queue);
 
 void initRtos(void);
 void startRtos(void);
+void initCycleCounter(void);
+bool checkWarmBoot(void);
+void bootPhase(const char name[]);
+void printBootPhases(void);
+void reboot(void);
+uint32_t getCycles(void);
 
+uint8_t findTask(_fn fn);
 bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes);
+bool createThreads(const THREAD_DESC threads[], uint8_t count);
 void killThread(_fn fn);
 void restartThread(_fn fn);
 void setThreadPriority(_fn fn, uint8_t priority);
+uint32_t measureStack(uint8_t task);
+uint8_t getStackInfo(STACK_INFO info[]);
+bool hitStackGuard(uint32_t mfault, uint32_t address);
+void recoverStackOverflow(void);
+bool containFault(void);
+
+void waitSemaphore(HANDLE handle);
+void signalSemaphore(HANDLE handle);
+bool postFromIsr(HANDLE semaphore);
+bool setEventsFromIsr(HANDLE group, uint32_t bits);
+bool notifyFromIsr(uint8_t task, uint32_t value, uint8_t action);
+bool notifyTask(uint8_t task, uint32_t value, uint8_t action);
+uint32_t setEventFlags(HANDLE handle, uint32_t bits);
+bool queueSendFromIsr(uint8_t queue, const void *data, uint8_t size);
+void runIsrRequests(void);
 
 void yield(void);
 void sleep(uint32_t tick);
-void wait(int8_t semaphore);
-void post(int8_t semaphore);
-void lock(int8_t mutex);
-void unlock(int8_t mutex);
+void wait(HANDLE semaphore);
+void post(HANDLE semaphore);
+void lock(HANDLE mutex);
+void unlock(HANDLE mutex);
+bool waitTimeout(HANDLE semaphore, uint32_t timeout);
+bool lockTimeout(HANDLE mutex, uint32_t timeout);
+uint32_t setEvents(HANDLE group, uint32_t bits);
+uint32_t clearEvents(HANDLE group, uint32_t bits);
+uint32_t waitEvents(HANDLE group, uint32_t mask, uint8_t options, uint32_t timeout);
+bool notify(_fn fn, uint32_t value, uint8_t action);
+uint32_t waitNotify(uint32_t mask, uint32_t timeout);
+void semaphoreWait(HANDLE semaphore);
+void semaphorePost(HANDLE semaphore);
+void mutexLock(HANDLE mutex);
+void mutexUnlock(HANDLE mutex);
+bool queueSend(uint8_t queue, void *msg);
+void *queueReceive(uint8_t queue);
+void *queueReceiveTimeout(uint8_t queue, uint32_t timeout);
+void *malloc_heap(uint32_t size_in_bytes);
+void free_heap(void *p);
+uint8_t benchmarkQueues(QUEUE_BENCH result[]);
+void *openShared(const char name[], uint32_t size_in_bytes, bool readOnly);
+void closeShared(const char name[]);
+uint8_t getSharedInfo(SHARED_INFO info[], uint8_t max);
+uint8_t getTaskInfo(TASK_INFO info[], uint32_t *time);
+uint8_t getIpcInfo(IPC_INFO info[]);
+void resetIpcStats(void);
+uint8_t getLatencyInfo(LATENCY_INFO info[]);
+void resetLatency(void);
+bool startProfile(uint16_t samples);
+uint16_t stopProfile(uint32_t **samples, void **top);
 
 void systickIsr(void);
 void pendSvIsr(void);
@@ -0,0 +1,207 @@
+// Binary log
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Log calls store a message ID and raw arguments in a ring, nothing is formatted at the call site
+// The low priority logDrain task formats records, or prints them raw for tools/logdecode.py
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "kernel.h"
+#include "asm.h"
+#include "uart0.h"
+#include "faults.h"
+#include "log.h"
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+// format strings, indexed by LOG_ID (in flash)
+#define X(id, format) format,
+const char* const logFormats[LOG_COUNT] = { LOG_MESSAGES };
+#undef X
+
+// drain prints raw records for tools/logdecode.py instead of formatting them on target
+const bool logRaw = false;
+
+LOG_ENTRY logRing[LOG_SIZE];
+volatile uint16_t logIn = 0;
+volatile uint16_t logOut = 0;
+uint16_t logDropped = 0;
+uint16_t logWritten = 0;          // records ever stored, saturates at LOG_SIZE (for recentLog)
+uint8_t logDrainTask = MAX_TASKS; // tcb index of logDrain, found on the first wakeup after it is created
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// Adds a record from kernel code (a few dozen cycles)
+// Interrupts are only masked while the slot is filled, so any handler can log
+void writeLog(uint8_t id, uint32_t arg0, uint32_t arg1)
+{
+    bool wasEmpty = false;
+    uint32_t primask = disableInterrupts();
+    uint16_t next = (logIn + 1) & (LOG_SIZE - 1);
+    if (next == logOut)
+    {
+        if (logDropped < 0xFFFF) logDropped++;
+    }
+    else
+    {
+        LOG_ENTRY *entry = &logRing[logIn];
+        entry->time = DWT_CYCCNT_R;
+        entry->id = id;
+        entry->task = taskCurrent;
+        entry->dropped = logDropped;
+        entry->arg[0] = arg0;
+        entry->arg[1] = arg1;
+        logDropped = 0;
+        if (logWritten < LOG_SIZE) logWritten++;
+        wasEmpty = logIn == logOut;
+        logIn = next;
+    }
+    restoreInterrupts(primask);
+
+    // only wake the drain task when it could be waiting
+    if (wasEmpty)
+    {
+        if (logDrainTask == MAX_TASKS) logDrainTask = findTask(logDrain);
+        notifyTask(logDrainTask, 1, NOTIFY_SET_BITS);
+    }
+}
+
+// Adds a record from a task
+void logWrite(uint8_t id, uint32_t arg0, uint32_t arg1)
+{
+    __asm("    SVC #21");
+}
+
+// Adds a record, the ring is in OS memory so tasks go through the kernel
+void logEvent(uint8_t id, uint32_t arg0, uint32_t arg1)
+{
+    if (calledFromTask())
+        logWrite(id, arg0, arg1);
+    else
+        writeLog(id, arg0, arg1);
+}
+
+// Removes the oldest record and copies the logging task's name (kernel side of readLog)
+bool takeLog(LOG_ENTRY *entry, char name[])
+{
+    uint8_t i;
+    if (logOut == logIn) return false;
+    *entry = logRing[logOut];
+    logOut = (logOut + 1) & (LOG_SIZE - 1);
+    for (i = 0; i < 15 && tcb[entry->task].name[i] != '\0'; i++)
+        name[i] = tcb[entry->task].name[i];
+    name[i] = '\0';
+    return true;
+}
+
+// Copies the last max records written, oldest first, whether or not the drain task has printed them
+// Kernel only, used for the crash record
+uint8_t recentLog(LOG_ENTRY entry[], uint8_t max)
+{
+    uint8_t i;
+    uint8_t count = logWritten < max ? logWritten : max;
+    for (i = 0; i < count; i++)
+        entry[i] = logRing[(logIn - count + i) & (LOG_SIZE - 1)];
+    return count;
+}
+
+// Removes the oldest record, false if the log is empty
+bool readLog(LOG_ENTRY *entry, char name[]);
+
+// appends str to the line, leaving room for "\n"
+void appendLog(char buffer[], uint8_t *length, const char str[])
+{
+    while (*str != '\0' && *length < LOG_LINE_SIZE - 2)
+        buffer[(*length)++] = *str++;
+}
+
+// Formats a record into buffer (LOG_LINE_SIZE), reentrant so any task can use it
+// In raw mode the line is "#id time task name arg0 arg1 dropped" for tools/logdecode.py
+char* formatLog(const LOG_ENTRY *entry, const char name[], char buffer[])
+{
+    char number[11];
+    uint8_t length = 0;
+    uint8_t arg = 0;
+    const char *format;
+
+    if (logRaw)
+    {
+        appendLog(buffer, &length, "#");
+        appendLog(buffer, &length, uitoaBuf(entry->id, number));
+        appendLog(buffer, &length, " ");
+        appendLog(buffer, &length, inttohexBuf(entry->time, number));
+        appendLog(buffer, &length, " ");
+        appendLog(buffer, &length, uitoaBuf(entry->task, number));
+        appendLog(buffer, &length, " ");
+        appendLog(buffer, &length, name);
+        for (arg = 0; arg < LOG_ARGS; arg++)
+        {
+            appendLog(buffer, &length, " ");
+            appendLog(buffer, &length, inttohexBuf(entry->arg[arg], number));
+        }
+        appendLog(buffer, &length, " ");
+        appendLog(buffer, &length, uitoaBuf(entry->dropped, number));
+    }
+    else
+    {
+        if (entry->dropped)
+        {
+            appendLog(buffer, &length, "(");
+            appendLog(buffer, &length, uitoaBuf(entry->dropped, number));
+            appendLog(buffer, &length, " dropped) ");
+        }
+        appendLog(buffer, &length, name);
+        appendLog(buffer, &length, ": ");
+        format = entry->id < LOG_COUNT ? logFormats[entry->id] : "unknown log id %u";
+        while (*format != '\0')
+        {
+            if (format[0] == '%' && (format[1] == 'u' || format[1] == 'x') && arg < LOG_ARGS)
+            {
+                if (format[1] == 'u')
+                    appendLog(buffer, &length, uitoaBuf(entry->arg[arg], number));
+                else
+                    appendLog(buffer, &length, inttohexBuf(entry->arg[arg], number));
+                arg++;
+                format += 2;
+            }
+            else
+            {
+                if (length < LOG_LINE_SIZE - 2) buffer[length++] = *format;
+                format++;
+            }
+        }
+    }
+    buffer[length++] = '\n';
+    buffer[length] = '\0';
+    return buffer;
+}
+
+// Low priority task that prints the log
+void logDrain(void)
+{
+    LOG_ENTRY entry;
+    char name[16];
+    char line[LOG_LINE_SIZE];
+    while (true)
+    {
+        waitNotify(1, WAIT_FOREVER);
+        while (readLog(&entry, name))
+            putsUart0(formatLog(&entry, name, line));
+    }
+}
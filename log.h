@@ -0,0 +1,74 @@
+// Binary log
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+#ifndef LOG_H_
+#define LOG_H_
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_SIZE 32             // records in the ring (power of 2)
+#define LOG_ARGS 2              // raw arguments per record
+#define LOG_LINE_SIZE 80        // formatted line, including the task name
+
+// Log messages, X(id, format)
+// Formats take up to LOG_ARGS arguments as %u (decimal) or %x (hex), they are only expanded by the drain task
+// IDs are the position in this list, tools/logdecode.py reads this list to format raw records on the host
+#define LOG_MESSAGES \
+    X(LOG_BOOT,             "rtos started, first task psp %x") \
+    X(LOG_STACK_OVERFLOW,   "stack overflow, psp %x") \
+    X(LOG_SRAM_SIZE,        "sram access window: size %u is wrong") \
+    X(LOG_SRAM_RANGE,       "sram access window: %x (%u bytes) incorrect range") \
+    X(LOG_MALLOC_FAILED,    "malloc of %u bytes failed") \
+    X(LOG_TASK_FAULT,       "fault at pc %x, status %x") \
+    X(LOG_TASK_RESTART,     "task %u restarts in %u ms") \
+    X(LOG_CRASH_RECORD,     "crash record from the last run, pc %x, status %x (see crash)") \
+    X(LOG_ISR_DROPPED,      "%u isr requests dropped, request ring full") \
+    X(LOG_BAD_POINTER,      "service call pointer %x (%u bytes) refused, not accessible to the task") \
+    X(LOG_ISR_MESSAGE_LOST, "isr message for queue %u (%u bytes) lost, queue full or no heap") \
+    X(LOG_BAD_HANDLE,       "stale or invalid handle %x, task %u stopped") \
+    X(LOG_NOT_FROM_TASK,    "wait, lock or unlock of handle %x outside a task (exception %u) refused") \
+    X(LOG_USER,             "%u %x")
+
+#define X(id, format) id,
+typedef enum _LOG_ID
+{
+    LOG_MESSAGES
+    LOG_COUNT
+} LOG_ID;
+#undef X
+
+// one record, the cycle count is from DWT CYCCNT
+typedef struct _LOG_ENTRY
+{
+    uint32_t time;
+    uint8_t id;
+    uint8_t task;
+    uint16_t dropped;           // records lost to a full ring just before this one
+    uint32_t arg[LOG_ARGS];
+} LOG_ENTRY;
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+void logEvent(uint8_t id, uint32_t arg0, uint32_t arg1);
+void writeLog(uint8_t id, uint32_t arg0, uint32_t arg1);
+bool readLog(LOG_ENTRY *entry, char name[]);
+bool takeLog(LOG_ENTRY *entry, char name[]);
+uint8_t recentLog(LOG_ENTRY entry[], uint8_t max);
+char* formatLog(const LOG_ENTRY *entry, const char name[], char buffer[]);
+void logDrain(void);
+
+#endif
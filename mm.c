@@ -21,6 +21,7 @@
 #include "uart0.h"
 #include "faults.h"
 #include "kernel.h"
+#include "log.h"
 
 //-----------------------------------------------------------------------------
 // Global variables
@@ -29,6 +30,17 @@
 uint64_t srdBitmask = 0x0000000000000000;
 // there will be srd masks for each task in the tcb
 
+// named shared regions, owned by the kernel and mapped into the srd bits of each task using them
+typedef struct _SHARED
+{
+    char name[SHARED_NAME_SIZE];
+    int first;          // first block
+    int blocks;         // number of blocks
+    uint16_t tasks;     // bit per tcb index that maps the region, 0 if unused
+    uint16_t readOnly;  // bit per tcb index that maps it read-only (through region 6, not the srd bits)
+} SHARED;
+SHARED sharedRegions[MAX_SHARED];
+
 //typedef struct _BLOCK
 //{
 //    bool alloc;      // 1 allocated, 0 not allocated
@@ -85,23 +97,96 @@ void * mallocHeap(uint32_t size_in_bytes)
             }
             // get srd bits and apply them outside
             addSramAccessWindow(&srdBitmask, (void *)(HEAP_START + (i * BLOCK_SIZE)), blocks * BLOCK_SIZE);
+            addSramAccessWindow(&tcb[taskCurrent].srd, (void *)(HEAP_START + (i * BLOCK_SIZE)), blocks * BLOCK_SIZE);
+            updateSramAccessImage(taskCurrent);
             // applySramAccessMask(tcb[index].srd);
             return (void *)(HEAP_START + (i * BLOCK_SIZE) + (blocks * BLOCK_SIZE)); // pointer to end of block allocated
         }
 
         i += freeCount - 1; // if blocks not found, skip ahead to past the checked blocks
     }
+    writeLog(LOG_MALLOC_FAILED, size_in_bytes, 0);
     return NULL; // failed to find space
 }
 
-//TODO: UPDATE FREE TO WORK ON POINTER POINTING TO TOP OF BLOCK
+// returns the first block of the allocation that ends at p (the pointer returned by mallocHeap), or -1
+int findAllocation(void *p)
+{
+    if ((uint32_t)p <= HEAP_START || (uint32_t)p > HEAP_END || ((uint32_t)p % BLOCK_SIZE) != 0) return -1;
+
+    int last = ((uint32_t)p - 1 - HEAP_START) / BLOCK_SIZE;     // last block of the allocation
+    if (!blockArray[last].alloc) return -1;
+
+    int first = last - blockArray[last].size + 1;
+    if (first < 0 || blockArray[first].size != blockArray[last].size || blockArray[first].owner != blockArray[last].owner) return -1;
+    return first;
+}
+
+// moves the allocation ending at p to another owner without copying it, updating the srd bits of both tasks
+// a task index of MAX_TASKS stands for the kernel, which holds blocks while they are queued
+bool transferHeap(void *p, uint8_t from, uint8_t to)
+{
+    int first = findAllocation(p);
+    void *fromPid = (from < MAX_TASKS) ? tcb[from].pid : 0;
+    void *toPid = (to < MAX_TASKS) ? tcb[to].pid : 0;
+
+    if (first < 0 || blockArray[first].owner != fromPid) return false; // only the owner can give it away
+
+    uint64_t mask = 0;
+    int i;
+    for (i = first; i < first + blockArray[first].size; i++)
+    {
+        blockArray[i].owner = toPid;
+        mask |= (uint64_t)1 << (i + 4);
+    }
+    if (from < MAX_TASKS)
+    {
+        tcb[from].srd &= ~mask;
+        updateSramAccessImage(from);
+    }
+    if (to < MAX_TASKS)
+    {
+        tcb[to].srd |= mask;
+        updateSramAccessImage(to);
+    }
+    return true;
+}
+
+// allocates heap blocks owned by the kernel (no task has access to them), returns the base or NULL
+char *allocKernelBuffer(uint32_t size_in_bytes)
+{
+    void *top = mallocHeap(size_in_bytes);
+    if (top == NULL) return NULL;
+    int first = findAllocation(top);
+    transferHeap(top, taskCurrent, MAX_TASKS);
+    return (char *)(HEAP_START + (first * BLOCK_SIZE));
+}
+
+// frees blocks from allocKernelBuffer
+void freeKernelBuffer(char *base)
+{
+    int first = ((uint32_t)base - HEAP_START) / BLOCK_SIZE;
+    if (first < 0 || first >= NUM_BLOCKS || !blockArray[first].alloc || blockArray[first].owner != 0) return;
+
+    int size = blockArray[first].size;
+    int i;
+    for (i = first; i < first + size; i++)
+    {
+        blockArray[i].alloc = false;
+        blockArray[i].owner = 0;
+        blockArray[i].size = 0;
+        srdBitmask &= ~((uint64_t)1 << (i + 4));
+    }
+}
+
 // REQUIRED: add your free code here and update the SRD bits for the current thread
+// p is the pointer returned by mallocHeap (top of the blocks)
 void freeHeap(void *p)
 {
-    int blockIndex = ((uint32_t)p - HEAP_START) / BLOCK_SIZE;
+    int blockIndex = findAllocation(p);
 
-    if (blockIndex < 0 || blockIndex >= NUM_BLOCKS) return; // check if bad pointer, out of heap range
-    if (blockArray[blockIndex].owner != tcb[taskCurrent].pid || !blockArray[blockIndex].alloc) return; // not the owner of the memory or not allocated anyways
+    if (blockIndex < 0) return; // check if bad pointer, out of heap range or not allocated anyways
+    if (blockArray[blockIndex].owner != tcb[taskCurrent].pid) return; // not the owner of the memory
 
     int size = blockArray[blockIndex].size;
 
@@ -114,8 +199,44 @@ void freeHeap(void *p)
         blockArray[i].size = 0;
         // set that block to 0 in srdBitmask
         srdBitmask &= ~((uint64_t)(1 << (i + 4))); // makes 0 no RW access for unpriv
+        tcb[taskCurrent].srd &= ~((uint64_t)1 << (i + 4));
     }
-    applySramAccessMask(srdBitmask);
+    updateSramAccessImage(taskCurrent);
+    loadMpuImage(tcb[taskCurrent].mpuImage);
+}
+
+// frees every block owned by a task (used when a task is killed) and removes its srd bits
+void freeTaskHeap(uint8_t task)
+{
+    int i;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if (sharedRegions[i].tasks & (1 << task)) unmapSharedIndex(i, task);
+    }
+    for (i = 0; i < NUM_BLOCKS; i++)
+    {
+        if (blockArray[i].alloc && blockArray[i].owner == tcb[task].pid)
+        {
+            blockArray[i].alloc = false;
+            blockArray[i].owner = 0;
+            blockArray[i].size = 0;
+            srdBitmask &= ~((uint64_t)1 << (i + 4));
+        }
+    }
+    tcb[task].srd = 0;
+    updateSramAccessImage(task);
+}
+
+// bytes of heap owned by a task, including its stack
+uint32_t heapOwned(uint8_t task)
+{
+    uint32_t bytes = 0;
+    int i;
+    for (i = 0; i < NUM_BLOCKS; i++)
+    {
+        if (blockArray[i].alloc && blockArray[i].owner == tcb[task].pid) bytes += BLOCK_SIZE;
+    }
+    return bytes;
 }
 
 // REQUIRED: add code to initialize the memory manager
@@ -216,33 +337,306 @@ void applySramAccessMask(uint64_t srdBitMask)
     NVIC_MPU_ATTR_R |= (uint32_t) ((srdBitMask >> 24) & 0xFF) << 8;
 }
 
+// encodes the RBAR/RASR pair of each SRAM region (1-4) for srdBitMask
+// pairs are ordered to match MPUBASE, MPUATTR and the A1-A3 aliases so loadMpuImage() can write them in one burst
+void buildSramAccessImage(uint64_t srdBitMask, uint32_t image[])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+    {
+        image[2 * i]     = (0x20000000 + (i * 0x2000)) | NVIC_MPU_BASE_VALID | (i + 1);     // base, valid, region
+        image[2 * i + 1] = NVIC_MPU_ATTR_ENABLE | (12 << 1) | (0b001 << 24) |               // 8KiB, RW only for priv
+                           ((uint32_t)((srdBitMask >> (8 * i)) & 0xFF) << 8);              // srd bits for region
+    }
+}
+
+// encodes region 6 as a read-only window for unpriv over the shared regions the task maps read-only
+// the window is the 8KiB SRAM region holding them, with only their subregions enabled, so all of a task's
+// read-only maps must be in one SRAM region (see mapShared)
+// tasks without one get the private peripheral rule of allowPeripheralAccess, with one the hardware still
+// refuses unpriv access to the private peripheral bus
+void buildReadOnlyImage(uint8_t task, uint32_t image[])
+{
+    uint8_t enabled = 0;
+    int region = -1;
+    int i, j;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if (!(sharedRegions[i].readOnly & (1 << task))) continue;
+        region = (sharedRegions[i].first + 4) / 8;                  // heap block i is subregion i + 4
+        for (j = 0; j < sharedRegions[i].blocks; j++)
+            enabled |= 1 << ((sharedRegions[i].first + 4 + j) % 8);
+    }
+    if (region < 0)
+    {
+        image[8] = 0xE0000000 | NVIC_MPU_BASE_VALID | 6;
+        image[9] = NVIC_MPU_ATTR_ENABLE | (28 << 1) | (0b001 << 24) | (1 << 28);   // 512MB, RW only for priv, XN
+    }
+    else
+    {
+        image[8] = (0x20000000 + (region * 0x2000)) | NVIC_MPU_BASE_VALID | 6;
+        image[9] = NVIC_MPU_ATTR_ENABLE | (12 << 1) |              // 8KiB
+                   (0b010 << 24) |                                 // RW for priv, R only for unpriv
+                   (1 << 28) |                                     // XN: Execute Never
+                   ((uint32_t)(uint8_t)~enabled << 8);             // only the mapped subregions
+    }
+}
+
+// encodes region 7 as a no-access guard at the bottom of a stack, or disables it if stackBase is NULL
+// region 7 has priority over the SRAM regions so even privileged pushes (pendSvIsr) into the guard fault
+void buildStackGuardImage(void *stackBase, uint32_t image[])
+{
+    image[10] = (uint32_t)stackBase | NVIC_MPU_BASE_VALID | 7;  // blocks are 1KiB aligned
+    image[11] = 0;                                              // region disabled
+    if (stackBase != NULL)
+    {
+        image[11] = NVIC_MPU_ATTR_ENABLE |  // Enable Region
+                   (4 << 1) |               // Region Size: 32B - 2^5 (STACK_GUARD_BYTES)
+                   (0b000 << 24) |          // no access for priv or unpriv
+                   (1 << 28);               // XN: Execute Never
+    }
+}
+
+// rebuilds the cached mpu image of a task, only needed when its srd bits or stack change
+void updateSramAccessImage(uint8_t task)
+{
+    buildSramAccessImage(tcb[task].srd, tcb[task].mpuImage);
+    buildReadOnlyImage(task, tcb[task].mpuImage);
+    buildStackGuardImage(tcb[task].guarded ? tcb[task].stackBase : NULL, tcb[task].mpuImage);
+}
+
 // adds access to the requested SRAM address range
 void addSramAccessWindow(uint64_t *srdBitMask, uint32_t *baseAdd, uint32_t size_in_bytes)
 {
     if (size_in_bytes % 1024 != 0)
     {
-        putsUart0("sram access window: size is wrong\n");
+        writeLog(LOG_SRAM_SIZE, size_in_bytes, 0);
       return;
     }
     if ((uint32_t)baseAdd < 0x20001000 || (uint32_t)baseAdd + size_in_bytes > 0x20008000)
     {
-        putsUart0("sram access window: incorrect range\n");
+        writeLog(LOG_SRAM_RANGE, (uint32_t)baseAdd, size_in_bytes);
         return;
     }
 
     uint32_t start = ((uint32_t)baseAdd - 0x20000000) >> 10;                 // start subregion (find offset and divide)
     uint32_t end   = ((uint32_t)baseAdd - 0x20000000 + size_in_bytes) >> 10; // end subregion
 
-    int tcbsrd = 0x0000000000000000;
     int i;
     for (i = start; i < end; i++)
     {
         *srdBitMask |= (uint64_t) 1 << i; // turns bit on at that subregion, gets RW access
-        tcbsrd      |= (uint64_t) 1 << i; // turns bit on at that subregion for tcb
     }
+}
+
+// removes access to the requested SRAM address range
+void removeSramAccessWindow(uint64_t *srdBitMask, uint32_t *baseAdd, uint32_t size_in_bytes)
+{
+    uint32_t start = ((uint32_t)baseAdd - 0x20000000) >> 10;                 // start subregion
+    uint32_t end   = ((uint32_t)baseAdd - 0x20000000 + size_in_bytes) >> 10; // end subregion
+
+    int i;
+    for (i = start; i < end; i++)
+    {
+        *srdBitMask &= ~((uint64_t) 1 << i); // turns bit off at that subregion, no RW access for unpriv
+    }
+}
+
+// true if the shared region name matches (case sensitive)
+bool sameSharedName(const char name1[], const char name2[])
+{
+    uint8_t i;
+    for (i = 0; i < SHARED_NAME_SIZE; i++)
+    {
+        if (name1[i] != name2[i]) return false;
+        if (name1[i] == 0) return true;
+    }
+    return true;
+}
+
+// true if a read-only map of the shared region at index can share region 6 with the other read-only maps of task
+bool fitsReadOnlyWindow(int index, uint8_t task)
+{
+    int i;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if (i != index && (sharedRegions[i].readOnly & (1 << task))
+            && (sharedRegions[i].first + 4) / 8 != (sharedRegions[index].first + 4) / 8)
+            return false;
+    }
+    return true;
+}
+
+// returns the blocks of the shared region at index to the heap
+void releaseSharedBlocks(int index)
+{
+    int i;
+    for (i = sharedRegions[index].first; i < sharedRegions[index].first + sharedRegions[index].blocks; i++)
+    {
+        blockArray[i].alloc = false;
+        blockArray[i].owner = 0;
+        blockArray[i].size = 0;
+        srdBitmask &= ~((uint64_t)1 << (i + 4));
+    }
+}
+
+// maps the shared region name into a task, creating it with size_in_bytes (rounded up to blocks) if needed
+// the kernel owns the blocks so the region outlives any one task, returns the base of the region or NULL
+// read/write maps open the srd bits of the task, read-only maps go through region 6 (see buildReadOnlyImage)
+// mapping a region again changes the access of the task
+void *mapShared(const char name[], uint32_t size_in_bytes, uint8_t task, bool readOnly)
+{
+    int i, unused = -1;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if (sharedRegions[i].tasks != 0 && sameSharedName(sharedRegions[i].name, name)) break;
+        if (sharedRegions[i].tasks == 0 && unused < 0) unused = i;
+    }
+
+    if (i == MAX_SHARED)
+    {
+        // create the region from heap blocks handed over to the kernel
+        if (unused < 0) return NULL;
+        void *top = mallocHeap(size_in_bytes);
+        if (top == NULL) return NULL;
+        i = unused;
+        sharedRegions[i].first = findAllocation(top);
+        sharedRegions[i].blocks = blockArray[sharedRegions[i].first].size;
+        transferHeap(top, taskCurrent, MAX_TASKS);
+        uint8_t j;
+        for (j = 0; j < SHARED_NAME_SIZE - 1 && name[j] != 0; j++)
+        {
+            sharedRegions[i].name[j] = name[j];
+        }
+        sharedRegions[i].name[j] = 0;
+    }
+
+    uint32_t *base = (uint32_t *)(HEAP_START + (sharedRegions[i].first * BLOCK_SIZE));
+    if (readOnly)
+    {
+        if (!fitsReadOnlyWindow(i, task))
+        {
+            if (sharedRegions[i].tasks == 0) releaseSharedBlocks(i);
+            return NULL;
+        }
+        removeSramAccessWindow(&tcb[task].srd, base, sharedRegions[i].blocks * BLOCK_SIZE);
+        sharedRegions[i].readOnly |= 1 << task;
+    }
+    else
+    {
+        addSramAccessWindow(&tcb[task].srd, base, sharedRegions[i].blocks * BLOCK_SIZE);
+        sharedRegions[i].readOnly &= ~(1 << task);
+    }
+    sharedRegions[i].tasks |= 1 << task;
+    updateSramAccessImage(task);
+    return base;
+}
 
-    // update tcb for the task
-    tcb[taskCurrent].srd = tcbsrd;
+// removes a task from the shared region at index, the blocks are freed when no task maps it anymore
+void unmapSharedIndex(int index, uint8_t task)
+{
+    uint32_t *base = (uint32_t *)(HEAP_START + (sharedRegions[index].first * BLOCK_SIZE));
+    removeSramAccessWindow(&tcb[task].srd, base, sharedRegions[index].blocks * BLOCK_SIZE);
+    sharedRegions[index].tasks &= ~(1 << task);
+    sharedRegions[index].readOnly &= ~(1 << task);
+    updateSramAccessImage(task);
+
+    if (sharedRegions[index].tasks == 0)
+        releaseSharedBlocks(index);
+}
+
+// removes the shared region name from a task
+void unmapShared(const char name[], uint8_t task)
+{
+    int i;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if ((sharedRegions[i].tasks & (1 << task)) && sameSharedName(sharedRegions[i].name, name))
+        {
+            unmapSharedIndex(i, task);
+        }
+    }
+}
+
+// one row per task mapping of each shared region, returns the number of rows written (at most max)
+uint8_t copySharedMaps(SHARED_INFO info[], uint8_t max)
+{
+    uint8_t count = 0;
+    int i;
+    uint8_t task, j;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        for (task = 0; task < MAX_TASKS && count < max; task++)
+        {
+            if (!(sharedRegions[i].tasks & (1 << task))) continue;
+            for (j = 0; j < SHARED_NAME_SIZE; j++)
+            {
+                info[count].name[j] = sharedRegions[i].name[j];
+            }
+            for (j = 0; j < 16; j++)
+            {
+                info[count].task[j] = tcb[task].name[j];
+            }
+            info[count].base = HEAP_START + (sharedRegions[i].first * BLOCK_SIZE);
+            info[count].size = sharedRegions[i].blocks * BLOCK_SIZE;
+            info[count].readOnly = (sharedRegions[i].readOnly & (1 << task)) != 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+// true if task maps the heap block read-only (through region 6)
+bool readOnlyMapped(uint8_t task, int block)
+{
+    int i;
+    for (i = 0; i < MAX_SHARED; i++)
+    {
+        if ((sharedRegions[i].readOnly & (1 << task))
+            && block >= sharedRegions[i].first && block < sharedRegions[i].first + sharedRegions[i].blocks)
+            return true;
+    }
+    return false;
+}
+
+// true if task can access size bytes at p itself, the service calls check the pointers a task passes
+// before the kernel reads or writes through them with privilege
+// writes need the srd bits of the task (its stack, its heap blocks, the ipc page and read/write maps),
+// reads also allow flash and the read-only shared maps of the task
+bool taskCanAccess(uint8_t task, const void *p, uint32_t size, bool write)
+{
+    uint32_t start = (uint32_t)p;
+    uint32_t end = start + size;
+    uint32_t i;
+    if (size == 0) return true;
+    if (end >= start && !write && end <= FLASH_END) return true;
+    if (end < start || start < HEAP_START || end > HEAP_END)
+    {
+        writeLog(LOG_BAD_POINTER, start, size);
+        return false;
+    }
+    for (i = (start - 0x20000000) >> 10; i <= (end - 1 - 0x20000000) >> 10; i++)
+    {
+        if (tcb[task].srd & ((uint64_t)1 << i)) continue;
+        if (!write && readOnlyMapped(task, i - 4)) continue;      // heap block i is subregion i + 4
+        writeLog(LOG_BAD_POINTER, start, size);
+        return false;
+    }
+    return true;
+}
+
+// true if task can read the string at str, up to its terminator or max characters
+bool taskCanReadString(uint8_t task, const char str[], uint32_t max)
+{
+    uint32_t i;
+    for (i = 0; i < max; i++)
+    {
+        // checked again each time the string crosses into another subregion
+        if ((i == 0 || ((uint32_t)&str[i] & (BLOCK_SIZE - 1)) == 0) && !taskCanAccess(task, &str[i], 1, false))
+            return false;
+        if (str[i] == 0) break;
+    }
+    return true;
 }
 
 
@@ -336,8 +730,9 @@ void initMpu(void)
 
 void dumpHeap(void)
 {
-    putsUart0("HEAP BLOCK ALLOCATIONS\n");
-    putsUart0(" BLOCK |   ADDRESS   | REGION | ALLOC | SIZE | OWNER\n");
+    beginDump(2048);
+    dumpStr("HEAP BLOCK ALLOCATIONS\n");
+    dumpStr(" BLOCK |   ADDRESS   | REGION | ALLOC | SIZE | OWNER\n");
 
     int i;
     for (i = 0; i < NUM_BLOCKS; i++)
@@ -349,17 +744,18 @@ void dumpHeap(void)
         int alloc = 0; if (blockArray[i].alloc == true) alloc = 1;
         int owner = blockArray[i].owner;
 
-        putsUart0(uitoa(i));
-        putsUart0("  | ");
-        putsUart0(inttohex(address));
-        putsUart0(" | ");
-        putsUart0(uitoa(region));
-        putsUart0("  | ");
-        putsUart0(uitoa(alloc));
-        putsUart0("  | ");
-        putsUart0(uitoa(size));
-        putsUart0("  | ");
-        putsUart0(uitoa(owner));
-        putcUart0('\n');
+        dumpStr(uitoa(i));
+        dumpStr("  | ");
+        dumpStr(inttohex(address));
+        dumpStr(" | ");
+        dumpStr(uitoa(region));
+        dumpStr("  | ");
+        dumpStr(uitoa(alloc));
+        dumpStr("  | ");
+        dumpStr(uitoa(size));
+        dumpStr("  | ");
+        dumpStr(uitoa(owner));
+        dumpStr("\n");
     }
+    endDump();
 }
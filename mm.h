@@ -33,6 +33,7 @@ typedef struct _BLOCK
 #define HEAP_SIZE   0x7000
 #define BLOCK_SIZE  1024
 #define NUM_BLOCKS  (HEAP_SIZE / BLOCK_SIZE) // heap is 32 but 28 usable
+#define FLASH_END   0x00040000 // 256 KiB of flash from address 0
 
 BLOCK blockArray[NUM_BLOCKS];
 
@@ -49,7 +50,24 @@ void allowPeripheralAccess(void);
 void setupSramAccess(void);
 uint64_t createSramAccessMask(void);
 void applySramAccessMask(uint64_t srdBitMask);
+void buildSramAccessImage(uint64_t srdBitMask, uint32_t image[]);
+void updateSramAccessImage(uint8_t task);
+void buildReadOnlyImage(uint8_t task, uint32_t image[]);
+void buildStackGuardImage(void *stackBase, uint32_t image[]);
+void freeTaskHeap(uint8_t task);
+uint32_t heapOwned(uint8_t task);
+int findAllocation(void *p);
+char *allocKernelBuffer(uint32_t size_in_bytes);
+void freeKernelBuffer(char *base);
+bool transferHeap(void *p, uint8_t from, uint8_t to);
 void addSramAccessWindow(uint64_t *srdBitMask, uint32_t *baseAdd, uint32_t size_in_bytes);
+void removeSramAccessWindow(uint64_t *srdBitMask, uint32_t *baseAdd, uint32_t size_in_bytes);
+void *mapShared(const char name[], uint32_t size_in_bytes, uint8_t task, bool readOnly);
+void unmapShared(const char name[], uint8_t task);
+void unmapSharedIndex(int index, uint8_t task);
+uint8_t copySharedMaps(SHARED_INFO info[], uint8_t max);
+bool taskCanAccess(uint8_t task, const void *p, uint32_t size, bool write);
+bool taskCanReadString(uint8_t task, const char str[], uint32_t max);
 void initMpu(void);
 void dumpHeap(void);
 #endif
@@ -37,6 +37,9 @@
 #include "faults.h"
 #include "tasks.h"
 #include "shell.h"
+#include "log.h"
+#include "buttons.h"
+#include "timers.h"
 
 // function to test buttons and leds
 void testHW(void)
@@ -94,6 +97,30 @@ void testHW(void)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Threads
+//-----------------------------------------------------------------------------
+
+// Threads created at boot: entry, name, priority, stack bytes, started
+// Threads that are not started are KILLED until "run NAME"
+const THREAD_DESC threadTable[] =
+{
+    // Add required idle process at lowest priority
+    {idle,          "Idle",      7, 512,  true},
+    {idle2,         "Idle2",     7, 512,  true},
+    {idle3,         "Idle3",     7, 512,  true},
+    {logDrain,      "LogDrain",  6, 1024, true},
+    {timerTask,     "Timers",    1, 512,  true},  // runs the software timer callbacks
+    // Add other processes
+//  {lengthyFn,     "LengthyFn", 6, 1024, true},  // lock and unlock
+//  {oneshot,       "OneShot",   2, 1024, true},  // wait and sleep
+//  {readKeys,      "ReadKeys",  6, 512,  true},  // everything
+//  {important,     "Important", 0, 1024, true},  // lock, sleep, unlock
+//  {uncooperative, "Uncoop",    6, 1024, true},  // while (readPbs==8)
+//  {errant,        "Errant",    6, 1024, false}, // write to 0x2000000000 (shouldnt be able to)
+//  {shell,         "Shell",     6, 4096, true},
+};
+
 //-----------------------------------------------------------------------------
 // Main
 //-----------------------------------------------------------------------------
@@ -104,39 +131,49 @@ int main(void)
 
     // Initialize hardware
     initSystemClockTo40Mhz();
+    initCycleCounter();
+    checkWarmBoot();
     initHw();
     //testHW(); //works
+    if (!warmBoot) powerUpFlash();
+    bootPhase("hw");
     initUart0();
+    bootPhase("uart");
     initMemoryManager();
     initMpu();
+    bootPhase("mpu");
     initRtos();
+    initButtons();
+    bootPhase("rtos");
 
     // Setup UART0 baud rate
     setUart0BaudRate(115200, 40e6);
 
-    // Initialize mutexes and semaphores
-    initMutex(resource);
-    initSemaphore(keyPressed, 1);
-    initSemaphore(keyReleased, 0);
-    initSemaphore(flashReq, 5);
+    // Create mutexes and semaphores, tasks find them by name (the kernel semaphores are made by initRtos)
+    createMutex("resource");
+    createSemaphore(5, "flashReq");
 
-    // Add required idle process at lowest priority
-    ok =  createThread(idle, "Idle", 7, 512);
-    ok &=  createThread(idle2, "Idle2", 7, 512);
-    ok &=  createThread(idle3, "Idle3", 7, 512);
-    // Add other processes
-//    ok &= createThread(lengthyFn, "LengthyFn", 6, 1024); // lock and unlock
-//    ok &= createThread(flash4Hz, "Flash4Hz", 4, 512);    // sleep
-//    ok &= createThread(oneshot, "OneShot", 2, 1024);     // wait and sleep
-//    ok &= createThread(readKeys, "ReadKeys", 6, 512);    // everything
-//    ok &= createThread(debounce, "Debounce", 6, 1024);   // wait, sleep, and post
-//    ok &= createThread(important, "Important", 0, 1024); // lock, sleep, unlock
-//    ok &= createThread(uncooperative, "Uncoop", 6, 1024);// while (readPbs==8)
-//    ok &= createThread(errant, "Errant", 6, 1024);       // write to 0x2000000000 (shouldnt be able to)
-//    ok &= createThread(shell, "Shell", 6, 4096);
-
-    printTcb();
-    dumpHeap();
+    // Periodic actions are timer callbacks run by the timer task, readKeys starts and stops flash4Hz
+    createTimer("flash4Hz", flash4Hz, 125, TIMER_PERIODIC);
+
+    // Log a crash record retained from the last run
+    checkCrash();
+
+    // Register shell commands
+    initShell();
+
+    // Create the threads in the table
+    ok = createThreads(threadTable, sizeof(threadTable) / sizeof(threadTable[0]));
+    bootPhase("threads");
+
+    // boot dumps are skipped after reboot
+    if (!warmBoot)
+    {
+        printTcb();
+        dumpHeap();
+        bootPhase("dumps");
+    }
+    printBootPhases();
 
     // Start up RTOS
     if (ok)
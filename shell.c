@@ -13,6 +13,7 @@
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdlib.h>
 #include "tm4c123gh6pm.h"
 #include "shell.h"
 #include "uart0.h"
@@ -23,60 +24,37 @@
 
 // REQUIRED: Add header files here for your strings functions, ...
 
-// Info that can be accepted
-#define MAX_CHARS 80
-#define MAX_FIELDS 5
 #define longestCommand 7
 
-// UI info structure
-typedef struct _USER_DATA
-{
-    char buffer[MAX_CHARS+1];
-    uint8_t fieldCount;
-    uint8_t fieldPosition[MAX_FIELDS];
-    char fieldType[MAX_FIELDS];
-} USER_DATA;
+// room left above the measured peak for an exception frame with fp state and the stack guard
+#define STACK_MARGIN (104 + STACK_GUARD_BYTES)
+
+// ps samples cpu use and switch rates over this window
+#define PS_WINDOW_MS 250
+#define TOP_DEFAULT_S 2
+
+#define CYCLES_PER_US 40
+
+// uncontended lock/unlock and post/wait pairs timed by lockbench
+#define LOCKBENCH_ROUNDS 1000
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+// registered commands sorted by name (OS memory, the shell reads a copy through getCommands)
+const SHELL_COMMAND *commandTable[MAX_COMMANDS];
+uint8_t commandCount = 0;
 
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
 // Function that stores the inputed characters
+// uart0Isr echoes and edits the line, the shell sleeps until enter is pressed
 void getsUart0(USER_DATA *data)
 {
-    int count = 0;
-    while (count < MAX_CHARS)
-    {
-        while (!kbhitUart0())
-        {
-            yield();
-        }
-
-        // get the character input and store in variable
-        char c = getcUart0();
-        putcUart0(c);
-
-        // backspace and not first char
-        if ((c == 8 || c == 127) && count > 0)
-        {
-            count --;
-        }
-
-        // carriage return
-        else if (c == 13)
-        {
-            break;
-        }
-
-        // space bar or printable characters
-        else if (c >= 32)
-        {
-            data->buffer[count] = c;
-            count ++;
-        }
-
-    }
-    data->buffer[count] = 0;
+    getsUart0Line(data->buffer, MAX_CHARS + 1);
     return;
 }
 
@@ -149,21 +127,27 @@ int32_t getFieldInteger(USER_DATA* data, uint8_t fieldNumber)
         }
 }
 
-// check if strings are equal (not case sensitive)
-bool sameStr(const char *str1, const char *str2)
+// compare strings (not case sensitive), <0, 0 or >0 like strcmp
+int8_t compareStr(const char *str1, const char *str2)
 {
-    while (*str1 && *str2)
+    char str1Lower, str2Lower;
+    do
     {
-        char str1Lower, str2Lower;
         if (*str1 > 64 && *str1 < 91) str1Lower = *str1 + 32;  // if upper case turn lower
         else str1Lower = *str1;
         if (*str2 > 64 && *str2 < 91) str2Lower = *str2 + 32;  // if upper case turn lower
         else str2Lower = *str2;
-        if (str1Lower != str2Lower) return false;
+        if (str1Lower != str2Lower) return (str1Lower < str2Lower) ? -1 : 1;
         str1++;
         str2++;
-    }
-    return (*str1 == *str2); // loop ended cause one reached null, if both ended at null and didn't fail in the loop then they are equal
+    } while (str1Lower != '\0');
+    return 0;   // both ended at null without a difference
+}
+
+// check if strings are equal (not case sensitive)
+bool sameStr(const char *str1, const char *str2)
+{
+    return compareStr(str1, str2) == 0;
 }
 
 // function which returns true if the command matches the first field and the number of arguments (excluding the command field) is greater than or equal to the requested number of minimum arguments.
@@ -192,14 +176,297 @@ bool isCommand(USER_DATA* data, const char strCommand[], uint8_t minArguments)
 // OS Functions
 //------------------------------------------------------------------------------------------------------------------------------------------------------
 
+// prints a number with one decimal from a value in tenths
+void putsTenths(uint32_t tenths)
+{
+    putsUart0(uitoa(tenths / 10));
+    putcUart0('.');
+    putsUart0(uitoa(tenths % 10));
+}
+
+// takes two task snapshots ms apart and prints %cpu and switch rates over that window with the second snapshot
+// only the counters of the first snapshot are kept, so the shell stack holds one TASK_INFO table
+void sampleTasks(uint32_t ms)
+{
+    TASK_INFO info[MAX_TASKS];
+    uint32_t cycles[MAX_TASKS], voluntary[MAX_TASKS], involuntary[MAX_TASKS];
+    uint32_t start, end;
+    uint8_t count, i;
+
+    count = getTaskInfo(info, &start);
+    for (i = 0; i < count; i++)
+    {
+        cycles[i] = info[i].cycles;
+        voluntary[i] = info[i].voluntary;
+        involuntary[i] = info[i].involuntary;
+    }
+    sleep(ms);
+    // tasks created in the window have no first sample
+    if (getTaskInfo(info, &end) > count) putsUart0("(task list changed)\n");
+    uint32_t window = end - start;
+
+    putsUart0("NAME            | PID        | STATE   | BLOCKED ON  | TICKS | %CPU  | VOL/S | INVOL/S | STACK/PEAK/ALLOC | HEAP\n");
+    for (i = 0; i < count; i++)
+    {
+        if (info[i].pid == 0) continue;    // empty slot
+        putsUart0(info[i].name);
+        putsUart0(" | ");
+        putsUart0(inttohex((uint32_t)info[i].pid));
+        putsUart0(" | ");
+        putsUart0((char *)info[i].state);
+        putsUart0(" | ");
+        putsUart0(info[i].blockedOn[0] ? info[i].blockedOn : "-");
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].ticks));
+        putsUart0(" | ");
+        putsTenths(((uint64_t)(info[i].cycles - cycles[i]) * 1000) / window);
+        putsUart0(" | ");
+        putsUart0(uitoa(((info[i].voluntary - voluntary[i]) * 1000) / ms));
+        putsUart0(" | ");
+        putsUart0(uitoa(((info[i].involuntary - involuntary[i]) * 1000) / ms));
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].stackUsed));
+        putcUart0('/');
+        putsUart0(uitoa(info[i].stackPeak));
+        putcUart0('/');
+        putsUart0(uitoa(info[i].stackAlloc));
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].heapBytes));
+        putcUart0('\n');
+    }
+}
+
 void ps(void)
 {
-    putsUart0("ps called");
+    sampleTasks(PS_WINDOW_MS);
 }
 
+// semaphore counts, mutex holders, queued messages and event flags with the tasks waiting on each
 void ipcs(void)
 {
-    putsUart0("ipcs called");
+    TASK_INFO tasks[MAX_TASKS];
+    IPC_INFO info[MAX_IPC];
+    uint32_t time;
+    uint8_t taskCount = getTaskInfo(tasks, &time);
+    uint8_t count = getIpcInfo(info);
+    uint8_t i, j;
+
+    putsUart0("NAME        | HANDLE     | TYPE      | VALUE | OWNER | WAITERS\n");
+    for (i = 0; i < count; i++)
+    {
+        putsUart0(info[i].name[0] ? info[i].name : "-");
+        putsUart0(" | ");
+        putsUart0(info[i].handle != NO_HANDLE ? inttohex(info[i].handle) : "-");
+        putsUart0(" | ");
+        if (info[i].type == IPC_SEMAPHORE)
+        {
+            putsUart0("semaphore | count ");
+            putsUart0(uitoa(info[i].value));
+            putsUart0(" | -");
+        }
+        else if (info[i].type == IPC_MUTEX)
+        {
+            putsUart0("mutex     | ");
+            putsUart0(info[i].value ? "locked | " : "free | ");
+            putsUart0((info[i].value && info[i].owner < taskCount) ? tasks[info[i].owner].name : "-");
+        }
+        else if (info[i].type == IPC_EVENT)
+        {
+            putsUart0("events    | flags ");
+            putsUart0(inttohex(info[i].value));
+            putsUart0(" | -");
+        }
+        else
+        {
+            putsUart0("queue     | msgs ");
+            putsUart0(uitoa(info[i].value));
+            putsUart0(" | -");
+        }
+        putsUart0(" |");
+        for (j = 0; j < info[i].waiters; j++)
+        {
+            putcUart0(' ');
+            if (info[i].waiter[j] < taskCount) putsUart0(tasks[info[i].waiter[j]].name);
+        }
+        putcUart0('\n');
+    }
+
+    // contention, waits are averaged over the acquisitions that blocked
+    putsUart0("\nNAME        | ACQUIRED | CONTENDED | WAIT AVG/MAX us | HOLD AVG/MAX us\n");
+    for (i = 0; i < count; i++)
+    {
+        if (info[i].type == IPC_QUEUE || info[i].type == IPC_EVENT) continue;
+        LOCK_STATS *stats = &info[i].stats;
+        putsUart0(info[i].name[0] ? info[i].name : "-");
+        putsUart0(" | ");
+        putsUart0(uitoa(stats->acquisitions));
+        putsUart0(" | ");
+        putsUart0(uitoa(stats->contended));
+        putsUart0(" | ");
+        putsUart0(uitoa(stats->contended ? (uint32_t)(stats->waitCycles / stats->contended / CYCLES_PER_US) : 0));
+        putcUart0('/');
+        putsUart0(uitoa(stats->maxWaitCycles / CYCLES_PER_US));
+        putsUart0(" | ");
+        if (info[i].type == IPC_MUTEX)
+        {
+            putsUart0(uitoa(stats->acquisitions ? (uint32_t)(stats->holdCycles / stats->acquisitions / CYCLES_PER_US) : 0));
+            putcUart0('/');
+            putsUart0(uitoa(stats->maxHoldCycles / CYCLES_PER_US));
+        }
+        else
+            putcUart0('-');
+        putcUart0('\n');
+    }
+}
+
+// wakeup to dispatch latency of each task, as counts per log2 bucket with the bucket's upper bound
+void latency(void)
+{
+    LATENCY_INFO info[MAX_TASKS];
+    uint8_t count = getLatencyInfo(info);
+    uint8_t i, j;
+
+    putsUart0("NAME            | MAX us | COUNT BELOW us\n");
+    for (i = 0; i < count; i++)
+    {
+        if (info[i].name[0] == '\0') continue;
+        putsUart0(info[i].name);
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].maxCycles / CYCLES_PER_US));
+        putsUart0(" |");
+        for (j = 0; j < LATENCY_BUCKETS; j++)
+        {
+            if (info[i].bucket[j] == 0) continue;
+            putcUart0(' ');
+            putsUart0(uitoa(info[i].bucket[j]));
+            if (j == LATENCY_BUCKETS - 1)
+                putsUart0("@more");
+            else
+            {
+                putsUart0("@<");
+                putsUart0(uitoa(((1 << (j + LATENCY_SHIFT + 1)) + CYCLES_PER_US - 1) / CYCLES_PER_US));
+            }
+        }
+        putcUart0('\n');
+    }
+}
+
+// prints the samples of the profiler for tools/profile.py and frees them
+// "#task INDEX NAME" lines name the tasks, "$" lines hold TASK:PC samples
+void profileDump(void)
+{
+    TASK_INFO tasks[MAX_TASKS];
+    uint32_t *samples;
+    void *top;
+    uint32_t time;
+    uint16_t count = stopProfile(&samples, &top);
+    uint8_t taskCount = getTaskInfo(tasks, &time);
+    uint16_t i;
+
+    if (samples == NULL)
+    {
+        putsUart0("profiler not running");
+        return;
+    }
+    putsUart0("#profile ");
+    putsUart0(uitoa(count));
+    putsUart0(" samples, 1ms\n");
+    for (i = 0; i < taskCount; i++)
+    {
+        if (tasks[i].pid == 0) continue;
+        putsUart0("#task ");
+        putsUart0(uitoa(i));
+        putcUart0(' ');
+        putsUart0(tasks[i].name);
+        putcUart0('\n');
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (i % 6 == 0) putsUart0(i ? "\n$" : "$");
+        putcUart0(' ');
+        putsUart0(uitoa(samples[i] >> PROFILE_TASK_SHIFT));
+        putcUart0(':');
+        putsUart0(inttohex(samples[i] & PROFILE_PC_MASK));
+    }
+    putsUart0("\n#end");
+    free_heap(top);
+}
+
+// prints the crash record for tools/crashdecode.py, "#task INDEX NAME" lines name the tasks of the log events
+void crash(void)
+{
+    const char* const faultNames[] = {"Hard", "MPU", "Bus", "Usage"};
+    const char* const frameNames[] = {"r0", "r1", "r2", "r3", "r12", "lr", "pc", "xpsr"};
+    CRASH_RECORD record;
+    TASK_INFO tasks[MAX_TASKS];
+    char line[LOG_LINE_SIZE];
+    uint32_t time;
+    uint8_t taskCount;
+    uint8_t i;
+
+    if (!getCrashRecord(&record))
+    {
+        putsUart0("no crash record");
+        return;
+    }
+    taskCount = getTaskInfo(tasks, &time);
+
+    putsUart0("#crash ");
+    putsUart0((record.exception >= 3 && record.exception <= 6) ? faultNames[record.exception - 3] : "Unknown");
+    putsUart0(" fault in ");
+    putsUart0(record.task);
+    putsUart0(", task ");
+    putsUart0(uitoa(record.taskIndex));
+    putcUart0('\n');
+    for (i = 0; i < 8; i++)
+    {
+        putsUart0(frameNames[i]);
+        putcUart0(' ');
+        putsUart0(inttohex(record.frame[i]));
+        putcUart0('\n');
+    }
+    putsUart0("psp ");   putsUart0(inttohex(record.psp));   putcUart0('\n');
+    putsUart0("cfsr ");  putsUart0(inttohex(record.cfsr));  putcUart0('\n');
+    putsUart0("hfsr ");  putsUart0(inttohex(record.hfsr));  putcUart0('\n');
+    putsUart0("mmfar "); putsUart0(inttohex(record.mmfar)); putcUart0('\n');
+    putsUart0("bfar ");  putsUart0(inttohex(record.bfar));  putcUart0('\n');
+    for (i = 0; i < record.stackWords; i++)
+    {
+        if (i % 4 == 0) putsUart0(i ? "\nstack" : "stack");
+        putcUart0(' ');
+        putsUart0(inttohex(record.stack[i]));
+    }
+    if (record.stackWords) putcUart0('\n');
+    for (i = 0; i < taskCount; i++)
+    {
+        if (tasks[i].pid == 0) continue;
+        putsUart0("#task ");
+        putsUart0(uitoa(i));
+        putcUart0(' ');
+        putsUart0(tasks[i].name);
+        putcUart0('\n');
+    }
+    for (i = 0; i < record.logCount; i++)
+    {
+        putsUart0("log ");
+        putsUart0(formatLog(&record.log[i], record.log[i].task < taskCount ? tasks[record.log[i].task].name : "?", line));
+    }
+    putsUart0("#end");
+}
+
+// redraws ps every seconds until enter is pressed
+void top(uint32_t seconds)
+{
+    char line[MAX_CHARS + 1];
+    while (!kbhitUart0())
+    {
+        putsUart0("\033[2J\033[H");   // clear screen, cursor home
+        putsUart0("top - every ");
+        putsUart0(uitoa(seconds));
+        putsUart0("s, enter to stop\n");
+        sampleTasks(seconds * 1000);
+    }
+    getsUart0Line(line, sizeof(line)); // discard the line that stopped it
 }
 
 void kill(uint32_t pidK)
@@ -251,12 +518,154 @@ void pidof(char *name)
     putsUart0(name);
     putsUart0(" launched");
 }
+// starts a killed thread by name, including threads in the boot table that are not started
 void run(char *name)
 {
+    TASK_INFO info[MAX_TASKS];
+    uint32_t time;
+    uint8_t count = getTaskInfo(info, &time);
+    uint8_t i;
+    for (i = 0; i < count; i++)
+    {
+        if (info[i].pid != 0 && sameStr(info[i].name, name))
+        {
+            restartThread((_fn)info[i].pid);
+            return;
+        }
+    }
     if (sameStr(name, "blue"))
         setPinValue(BLUE_LED, 1); // test function turning red led on
 }
 
+// allocated stack, peak use and a recommended size (rounded up to whole heap blocks) for each task
+void stack(void)
+{
+    STACK_INFO info[MAX_TASKS];
+    uint8_t count = getStackInfo(info);
+    uint8_t i;
+
+    putsUart0("NAME            | ALLOC | PEAK  | RECOMMENDED\n");
+    for (i = 0; i < count; i++)
+    {
+        uint32_t recommended = ((info[i].peak + STACK_MARGIN + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+        putsUart0(info[i].name);
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].allocated));
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].peak));
+        putsUart0(" | ");
+        putsUart0(uitoa(recommended));
+        putcUart0('\n');
+    }
+}
+
+// per message cost of passing 64B, 1KiB and 4KiB messages by ownership transfer vs copying
+void qbench(void)
+{
+    QUEUE_BENCH result[QBENCH_SIZES];
+    uint8_t count = benchmarkQueues(result);
+    uint8_t i;
+
+    putsUart0("BYTES | ZERO COPY CYCLES | COPY CYCLES\n");
+    for (i = 0; i < count; i++)
+    {
+        putsUart0(uitoa(result[i].bytes));
+        putsUart0(" | ");
+        if (result[i].zeroCopyCycles == 0)
+        {
+            putsUart0("no heap space\n");
+            continue;
+        }
+        putsUart0(uitoa(result[i].zeroCopyCycles));
+        putsUart0(" | ");
+        putsUart0(uitoa(result[i].copyCycles));
+        putcUart0('\n');
+    }
+}
+
+// cycles per uncontended lock/unlock and post/wait pair, through the fast paths and through the kernel
+void lockbench(void)
+{
+    HANDLE m = createMutex("bench");
+    HANDLE s = createSemaphore(0, "bench");
+    uint32_t fast, kernel, start;
+    uint16_t r;
+
+    if (m == NO_HANDLE || s == NO_HANDLE)
+    {
+        putsUart0("no free mutex or semaphore\n");
+        destroyMutex(m);
+        destroySemaphore(s);
+        return;
+    }
+
+    if (!FAST_IPC_PATHS) putsUart0("fast paths are off (FAST_IPC_PATHS), both columns go through the kernel\n");
+    putsUart0("PAIR        | FAST CYCLES | SVC CYCLES\n");
+    start = getCycles();
+    for (r = 0; r < LOCKBENCH_ROUNDS; r++)
+    {
+        lock(m);
+        unlock(m);
+    }
+    fast = (getCycles() - start) / LOCKBENCH_ROUNDS;
+    start = getCycles();
+    for (r = 0; r < LOCKBENCH_ROUNDS; r++)
+    {
+        mutexLock(m);
+        mutexUnlock(m);
+    }
+    kernel = (getCycles() - start) / LOCKBENCH_ROUNDS;
+    putsUart0("lock/unlock | ");
+    putsUart0(uitoa(fast));
+    putsUart0(" | ");
+    putsUart0(uitoa(kernel));
+    putcUart0('\n');
+
+    start = getCycles();
+    for (r = 0; r < LOCKBENCH_ROUNDS; r++)
+    {
+        post(s);
+        wait(s);
+    }
+    fast = (getCycles() - start) / LOCKBENCH_ROUNDS;
+    start = getCycles();
+    for (r = 0; r < LOCKBENCH_ROUNDS; r++)
+    {
+        semaphorePost(s);
+        semaphoreWait(s);
+    }
+    kernel = (getCycles() - start) / LOCKBENCH_ROUNDS;
+    putsUart0("post/wait   | ");
+    putsUart0(uitoa(fast));
+    putsUart0(" | ");
+    putsUart0(uitoa(kernel));
+    putcUart0('\n');
+
+    destroyMutex(m);
+    destroySemaphore(s);
+}
+
+// shared regions and the tasks that map them
+void shm(void)
+{
+    SHARED_INFO info[MAX_SHARED * 4];
+    uint8_t count = getSharedInfo(info, MAX_SHARED * 4);
+    uint8_t i;
+
+    putsUart0("REGION   |   ADDRESS   | SIZE | ACCESS | TASK\n");
+    for (i = 0; i < count; i++)
+    {
+        putsUart0(info[i].name);
+        putsUart0(" | ");
+        putsUart0(inttohex(info[i].base));
+        putsUart0(" | ");
+        putsUart0(uitoa(info[i].size));
+        putsUart0(info[i].readOnly ? " | r      | " : " | rw     | ");
+        putsUart0(info[i].task);
+        putcUart0('\n');
+    }
+}
+
 //------------------------------------------------------------------------------------------------------------------------------------------------------
 // Fault Trigger Functions (bus, usage, hard, mpu, pendsv)
 //------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -397,6 +806,341 @@ void test2()
     uint32_t val = *k;
 }
 
+//------------------------------------------------------------------------------------------------------------------------------------------------------
+// Command Table
+//------------------------------------------------------------------------------------------------------------------------------------------------------
+
+// adds a command from init code (privileged), the table is kept sorted for findCommand
+bool registerCommand(const SHELL_COMMAND *command)
+{
+    uint8_t i;
+    if (commandCount >= MAX_COMMANDS) return false;
+    i = commandCount;
+    while (i > 0 && compareStr(commandTable[i - 1]->name, command->name) > 0)
+    {
+        commandTable[i] = commandTable[i - 1];
+        i--;
+    }
+    if (i > 0 && compareStr(commandTable[i - 1]->name, command->name) == 0)
+    {
+        // already registered, close the gap again
+        for (; i < commandCount; i++)
+            commandTable[i] = commandTable[i + 1];
+        return false;
+    }
+    commandTable[i] = command;
+    commandCount++;
+    return true;
+}
+
+// copies the sorted table (kernel side of getCommands)
+uint8_t copyCommands(const SHELL_COMMAND *list[], uint8_t max)
+{
+    uint8_t i;
+    for (i = 0; i < commandCount && i < max; i++)
+        list[i] = commandTable[i];
+    return i;
+}
+
+// binary search of a sorted command list, NULL if the name is not there
+const SHELL_COMMAND* findCommand(const SHELL_COMMAND *list[], uint8_t count, const char name[])
+{
+    int8_t low = 0;
+    int8_t high = count - 1;
+    while (low <= high)
+    {
+        int8_t mid = (low + high) / 2;
+        int8_t order = compareStr(name, list[mid]->name);
+        if (order == 0) return list[mid];
+        if (order < 0) high = mid - 1;
+        else low = mid + 1;
+    }
+    return NULL;
+}
+
+// checks the argument count and types against the command's descriptor
+bool checkArguments(USER_DATA* data, const SHELL_COMMAND *command)
+{
+    uint8_t i;
+    for (i = 0; command->args[i] != '\0'; i++)
+    {
+        if (i + 1 >= data->fieldCount) return false;
+        if (command->args[i] != 's' && command->args[i] != data->fieldType[i + 1]) return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------------------------
+// Shell Commands
+//------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void helpCommand(USER_DATA *data)
+{
+    const SHELL_COMMAND *list[MAX_COMMANDS];
+    uint8_t count = getCommands(list, MAX_COMMANDS);
+    uint8_t i;
+    for (i = 0; i < count; i++)
+    {
+        putsUart0(list[i]->usage);
+        putcUart0('\n');
+    }
+}
+
+void rebootCommand(USER_DATA *data)
+{
+    reboot();
+}
+
+void psCommand(USER_DATA *data)
+{
+    ps();
+}
+
+// ipcs [RESET]
+void ipcsCommand(USER_DATA *data)
+{
+    if (data->fieldCount > 1 && sameStr(getFieldString(data, 1), "reset"))
+    {
+        resetIpcStats();
+        putsUart0("ipc stats cleared");
+    }
+    else
+        ipcs();
+}
+
+// latency [RESET]
+void latencyCommand(USER_DATA *data)
+{
+    if (data->fieldCount > 1 && sameStr(getFieldString(data, 1), "reset"))
+    {
+        resetLatency();
+        putsUart0("latency histograms cleared");
+    }
+    else
+        latency();
+}
+
+// crash [CLEAR]
+void crashCommand(USER_DATA *data)
+{
+    if (data->fieldCount > 1 && sameStr(getFieldString(data, 1), "clear"))
+    {
+        clearCrashRecord();
+        putsUart0("crash record cleared");
+    }
+    else
+        crash();
+}
+
+// profile START [SAMPLES] | STOP
+void profileCommand(USER_DATA *data)
+{
+    char *action = getFieldString(data, 1);
+    if (sameStr(action, "start"))
+    {
+        uint16_t samples = (data->fieldCount > 2) ? getFieldInteger(data, 2) : PROFILE_MAX_SAMPLES;
+        putsUart0(startProfile(samples) ? "profiling" : "no heap space for samples");
+    }
+    else if (sameStr(action, "stop"))
+        profileDump();
+    else
+        putsUart0("usage: profile START [SAMPLES] | STOP");
+}
+
+// top [SECONDS]
+void topCommand(USER_DATA *data)
+{
+    uint32_t seconds = TOP_DEFAULT_S;
+    if (data->fieldCount > 1 && data->fieldType[1] == 'n' && getFieldInteger(data, 1) > 0)
+        seconds = getFieldInteger(data, 1);
+    top(seconds);
+}
+
+void killCommand(USER_DATA *data)
+{
+    int32_t pidK = getFieldInteger(data, 1);
+    kill(pidK);
+}
+
+void pkillCommand(USER_DATA *data)
+{
+    char* processName = getFieldString(data, 1);
+    pkill(processName);
+}
+
+void piCommand(USER_DATA *data)
+{
+    // Turns priority inheritance on or off
+    char* OnOff = getFieldString(data, 1);
+
+    if (sameStr(OnOff, "on"))
+    {
+        pi(true);
+    }
+    else if (sameStr(OnOff, "off"))
+    {
+        pi(false);
+    }
+    else
+    {
+        putsUart0("invalid on|off field");
+    }
+}
+
+void preemptCommand(USER_DATA *data)
+{
+    // Turns preemption on or off
+    char* OnOff = getFieldString(data, 1);
+
+    if (sameStr(OnOff, "on"))
+    {
+        preempt(true);
+    }
+    else if (sameStr(OnOff, "off"))
+    {
+        preempt(false);
+    }
+    else
+    {
+        putsUart0("invalid on|off field");
+    }
+}
+
+void schedCommand(USER_DATA *data)
+{
+    // either priority or round robin scheduling
+    char* prioRR = getFieldString(data, 1);
+
+    if (sameStr(prioRR, "prio"))
+        sched(true);
+    else if (sameStr(prioRR, "rr"))
+        sched(false);
+    else
+        putsUart0("invalid prio|rr field");
+}
+
+void pidofCommand(USER_DATA *data)
+{
+    char* name = getFieldString(data, 1);
+    pidof(name);
+}
+
+void runCommand(USER_DATA *data)
+{
+    char* name = getFieldString(data, 1);
+    run(name);
+}
+
+void stackCommand(USER_DATA *data)
+{
+    stack();
+}
+
+void qbenchCommand(USER_DATA *data)
+{
+    qbench();
+}
+
+void lockbenchCommand(USER_DATA *data)
+{
+    lockbench();
+}
+
+void shmCommand(USER_DATA *data)
+{
+    shm();
+}
+
+// trigger fault ISRs
+void trigCommand(USER_DATA *data)
+{
+    char* fault = getFieldString(data, 1);
+    if      (sameStr(fault, "bus"))    busFaltTrig();
+    else if (sameStr(fault, "usage"))  usageFaltTrig();
+    else if (sameStr(fault, "hard"))   hardFaltTrig();
+    else if (sameStr(fault, "mpu"))    mpuFaltTrig();
+    else if (sameStr(fault, "pendsv")) pendsvTrig();
+    else
+        putsUart0("Invalid. Trigger options: bus, usage, hard, mpu, pendsv");
+}
+
+// malloc size
+void mallocCommand(USER_DATA *data)
+{
+    uint32_t size = atoi(getFieldString(data, 1));
+    data->heap = malloc_heap(size);
+    if (!data->heap) putsUart0("invalid\n");
+    else putsUart0("success!\n");
+}
+
+void dumpHeapCommand(USER_DATA *data)
+{
+    //dumpHeap();
+}
+
+void freeCommand(USER_DATA *data)
+{
+    free_heap(data->heap);
+    data->heap = NULL;
+}
+
+void test1Command(USER_DATA *data)
+{
+    test1();
+}
+
+void test2Command(USER_DATA *data)
+{
+    test2();
+}
+
+void debugRCommand(USER_DATA *data)
+{
+    uint32_t region = atoi(getFieldString(data, 1));
+    NVIC_MPU_NUMBER_R = region;
+    volatile uint32_t regionReg = NVIC_MPU_ATTR_R;
+    putsUart0(inttohex(regionReg));
+}
+
+// built in commands, other subsystems add theirs with registerCommand
+const SHELL_COMMAND shellCommands[] =
+{
+    {"help",     "",  "help",                      helpCommand},
+    {"reboot",   "",  "reboot",                    rebootCommand},
+    {"ps",       "",  "ps",                        psCommand},
+    {"ipcs",     "",  "ipcs [RESET]",              ipcsCommand},
+    {"top",      "",  "top [SECONDS]",             topCommand},
+    {"latency",  "",  "latency [RESET]",           latencyCommand},
+    {"profile",  "a", "profile START [SAMPLES] | STOP", profileCommand},
+    {"crash",    "",  "crash [CLEAR]",             crashCommand},
+    {"kill",     "n", "kill PID",                  killCommand},
+    {"pkill",    "a", "pkill NAME",                pkillCommand},
+    {"pi",       "a", "pi ON|OFF",                 piCommand},
+    {"preempt",  "a", "preempt ON|OFF",            preemptCommand},
+    {"sched",    "a", "sched PRIO|RR",             schedCommand},
+    {"pidof",    "a", "pidof NAME",                pidofCommand},
+    {"run",      "a", "run NAME",                  runCommand},
+    {"stack",    "",  "stack",                     stackCommand},
+    {"qbench",   "",  "qbench",                    qbenchCommand},
+    {"lockbench", "", "lockbench",                 lockbenchCommand},
+    {"shm",      "",  "shm",                       shmCommand},
+    {"trig",     "a", "trig BUS|USAGE|HARD|MPU|PENDSV", trigCommand},
+    {"malloc",   "n", "malloc BYTES",              mallocCommand},
+    {"dumpHeap", "",  "dumpHeap",                  dumpHeapCommand},
+    {"free",     "",  "free",                      freeCommand},
+    {"test1",    "",  "test1",                     test1Command},
+    {"test2",    "",  "test2",                     test2Command},
+    {"debugR",   "n", "debugR REGION",             debugRCommand},
+};
+
+// registers the built in commands, call before startRtos
+void initShell(void)
+{
+    uint8_t i;
+    for (i = 0; i < sizeof(shellCommands) / sizeof(shellCommands[0]); i++)
+        registerCommand(&shellCommands[i]);
+}
+
 //------------------------------------------------------------------------------------------------------------------------------------------------------
 // Shell Function (mother? mom? mamacita)
 //------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -404,147 +1148,35 @@ void test2()
 void shell(void)
 {
     USER_DATA data;
+    const SHELL_COMMAND *commands[MAX_COMMANDS];
+    uint8_t count;
+    data.heap = NULL;
     while(true)
     {
         putsUart0("> ");
-        //get string from userCall allowFlashAccess(),
+        //get string from user (sleeps until enter)
         getsUart0(&data);
         //parse fields
         parseFields(&data);
-        //malloc testing
-        uint32_t* p;
-
-        if(isCommand(&data,"reboot",0))
-        {
-            // reboot later
-        }
-        else if(isCommand(&data,"ps",0))
-        {
-            ps();
-        }
-        else if(isCommand(&data,"ipcs",0))
-        {
-            ipcs();
-        }
-        else if(isCommand(&data,"kill",1))
-        {
-            int32_t pidK = getFieldInteger(&data, 1);
-            kill(pidK);
-        }
-        else if(isCommand(&data,"pkill",1))
-        {
-            char* processName = getFieldString(&data, 1);
-            pkill(processName);
-        }
-        else if (isCommand(&data, "pi", 1))
-        {
-            // Turns priority inheritance on or off
-            char* OnOff = getFieldString(&data, 1);
+        if (data.fieldCount == 0)
+            continue;
 
-            if (sameStr(OnOff, "on"))
-            {
-                pi(true);
-            }
-            else if (sameStr(OnOff, "off"))
-            {
-                pi(false);
-            }
-            else
-            {
-                putsUart0("invalid on|off field");
-            }
-        }
-        else if (isCommand(&data, "preempt", 1))
-        {
-            // Turns preemption on or off
-            char* OnOff = getFieldString(&data, 1);
+        // commands may have been registered since the last line
+        count = getCommands(commands, MAX_COMMANDS);
+        const SHELL_COMMAND *command = findCommand(commands, count, getFieldString(&data, 0));
 
-            if (sameStr(OnOff, "on"))
-            {
-                preempt(true);
-            }
-            else if (sameStr(OnOff, "off"))
-            {
-                preempt(false);
-            }
-            else
-            {
-                putsUart0("invalid on|off field");
-            }
-        }
-        else if (isCommand(&data, "sched", 1))
+        if (command == NULL)
         {
-            // either priority or round robin scheduling
-            char* prioRR = getFieldString(&data, 1);
-            bool prioOn;
-
-            if (sameStr(prioRR, "prio"))
-            {
-                prioOn = true;
-                sched(prioOn);
-            }
-            else if (sameStr(prioRR, "rr"))
-            {
-                prioOn = false;
-                sched(prioOn);
-            }
-            else
-                putsUart0("invalid prio|rr field");
-        }
-        else if (isCommand(&data, "pidof", 1))
-        {
-            char* name = getFieldString(&data, 1);
-            pidof(name);
-        }
-        else if (isCommand(&data, "run", 1))
-        {
-            char* name = getFieldString(&data, 1);
-            run(name);
-        }
-        else if (isCommand(&data, "trig", 1)) // trigger fault ISRs
-        {
-            char* fault = getFieldString(&data, 1);
-            if      (sameStr(fault, "bus"))    busFaltTrig();
-            else if (sameStr(fault, "usage"))  usageFaltTrig();
-            else if (sameStr(fault, "hard"))   hardFaltTrig();
-            else if (sameStr(fault, "mpu"))    mpuFaltTrig();
-            else if (sameStr(fault, "pendsv")) pendsvTrig();
-            else
-                putsUart0("Invalid. Trigger options: bus, usage, hard, mpu, pendsv");
-        }
-        else if (isCommand(&data, "malloc", 1)) // malloc size
-        {
-            uint32_t size = atoi(getFieldString(&data, 1));
-            p = malloc_heap(size);
-            if (!p) putsUart0("invalid\n");
-            else putsUart0("success!\n");
-        }
-        else if (isCommand(&data, "dumpHeap", 0))
-        {
-            //dumpHeap();
-        }
-        else if (isCommand(&data, "free", 0))
-        {
-            free_heap(p);
-        }
-        else if (isCommand(&data, "test1", 0))
-        {
-            test1();
-        }
-        else if (isCommand(&data, "test2", 0))
-        {
-            test2();
+            putsUart0("invalid command");
         }
-        else if (isCommand(&data, "debugR", 1))
+        else if (!checkArguments(&data, command))
         {
-            uint32_t region = atoi(getFieldString(&data, 1));
-            NVIC_MPU_NUMBER_R = region;
-            volatile uint32_t regionReg = NVIC_MPU_ATTR_R;
-            putsUart0(inttohex(regionReg));
+            putsUart0("usage: ");
+            putsUart0((char *)command->usage);
         }
         else
         {
-            putsUart0("invalid command");
+            command->handler(&data);
         }
         putcUart0('\n');
     }
@@ -11,6 +11,38 @@
 #ifndef SHELL_H_
 #define SHELL_H_
 
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Info that can be accepted
+#define MAX_CHARS 80
+#define MAX_FIELDS 5
+#define MAX_COMMANDS 32
+
+// UI info structure
+typedef struct _USER_DATA
+{
+    char buffer[MAX_CHARS+1];
+    uint8_t fieldCount;
+    uint8_t fieldPosition[MAX_FIELDS];
+    char fieldType[MAX_FIELDS];
+    void *heap;                 // last block from the malloc command
+} USER_DATA;
+
+// A shell command, kept in flash (const) so the unprivileged shell can read it
+// args has one character per required argument: 'n' numeric, 'a' alpha, 's' either
+typedef struct _SHELL_COMMAND
+{
+    const char *name;
+    const char *args;
+    const char *usage;
+    void (*handler)(USER_DATA *data);
+} SHELL_COMMAND;
+
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
@@ -20,10 +52,16 @@ void parseFields(USER_DATA *data);
 bool isCommand(USER_DATA* data, const char strCommand[], uint8_t minArguments);
 char* getFieldString(USER_DATA* data, uint8_t fieldNumber);
 int32_t getFieldInteger(USER_DATA* data, uint8_t fieldNumber);
+int8_t compareStr(const char str1[], const char str2[]);
 bool sameStr(const char str1[], const char str2[]);
 bool isCommand(USER_DATA* data, const char strCommand[], uint8_t minArguments);
 void ps(void);
 void ipcs(void);
+void sampleTasks(uint32_t ms);
+void latency(void);
+void profileDump(void);
+void crash(void);
+void top(uint32_t seconds);
 void kill(uint32_t pidK);
 void pkill(char* processName);
 void pi(bool on);
@@ -31,6 +69,10 @@ void preempt(bool on);
 void sched(bool prioOn);
 void pidof(char* name);
 void run(char* name);
+void stack(void);
+void qbench(void);
+void lockbench(void);
+void shm(void);
 void busFaltTrig(void);
 void usageFaltTrig(void);
 void hardFaltTrig(void);
@@ -38,6 +80,11 @@ void mpuFaltTrig(void);
 void pendsvTrig(void);
 void test1(void);
 void test2(void);
+bool registerCommand(const SHELL_COMMAND *command);
+uint8_t copyCommands(const SHELL_COMMAND *list[], uint8_t max);
+uint8_t getCommands(const SHELL_COMMAND *list[], uint8_t max);
+const SHELL_COMMAND* findCommand(const SHELL_COMMAND *list[], uint8_t count, const char name[]);
+void initShell(void);
 void shell(void);
 
 #endif
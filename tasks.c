@@ -19,6 +19,8 @@
 #include "wait.h"
 #include "kernel.h"
 #include "tasks.h"
+#include "buttons.h"
+#include "timers.h"
 
 //-----------------------------------------------------------------------------
 // Subroutines
@@ -27,11 +29,9 @@
 // Initialize Hardware
 // REQUIRED: Add initialization for blue, orange, red, green, and yellow LEDs
 //           Add initialization for 6 pushbuttons
+// The system clock is set to 40 MHz by main before this is called
 void initHw(void)
 {
-    // Initialize system clock to 40 MHz
-    initSystemClockTo40Mhz();
-
     // Enable PB and LED ports
     enablePort(PORTA);
     enablePort(PORTC);
@@ -64,12 +64,6 @@ void initHw(void)
     enablePinPullup(PB_4);
     enablePinPullup(PB_5);
 
-    // Power-up flash
-    setPinValue(GREEN_LED, 1);
-    waitMicrosecond(250000);
-    setPinValue(GREEN_LED, 0);
-    waitMicrosecond(250000);
-
     setPinValue(ORANGE_LED, 0);
 
     // Enable faults
@@ -83,6 +77,15 @@ void initHw(void)
 
 }
 
+// Power-up flash, only on a cold boot (500 ms)
+void powerUpFlash(void)
+{
+    setPinValue(GREEN_LED, 1);
+    waitMicrosecond(250000);
+    setPinValue(GREEN_LED, 0);
+    waitMicrosecond(250000);
+}
+
 // REQUIRED: add code to return a value from 0-6 indicating which of 6 PBs are pressed
 uint8_t readPbs(void)
 {
@@ -133,17 +136,15 @@ void idle3(void)
     }
 }
 
+// callback of the periodic flash4Hz timer (made in main), runs in the timer task every 125 ms
 void flash4Hz(void)
 {
-    while(true)
-    {
-        setPinValue(GREEN_LED, !getPinValue(GREEN_LED));
-        sleep(125);
-    }
+    setPinValue(GREEN_LED, !getPinValue(GREEN_LED));
 }
 
 void oneshot(void)
 {
+    HANDLE flashReq = findSemaphore("flashReq");
     while(true)
     {
         wait(flashReq);
@@ -163,6 +164,7 @@ void partOfLengthyFn(void)
 
 void lengthyFn(void)
 {
+    HANDLE resource = findMutex("resource");
     uint16_t i;
     while(true)
     {
@@ -176,19 +178,15 @@ void lengthyFn(void)
     }
 }
 
+// the button driver debounces in its isrs, so this only runs when a button is pressed or released
 void readKeys(void)
 {
+    HANDLE flashReq = findSemaphore("flashReq");
+    HANDLE flashTimer = findTimer("flash4Hz");
     uint8_t buttons;
     while(true)
     {
-        wait(keyReleased);
-        buttons = 0;
-        while (buttons == 0)
-        {
-            buttons = readPbs();
-            yield();
-        }
-        post(keyPressed);
+        buttons = BUTTON_PRESSES(waitButtons());
         if ((buttons & 1) != 0)
         {
             setPinValue(YELLOW_LED, !getPinValue(YELLOW_LED));
@@ -201,11 +199,11 @@ void readKeys(void)
         }
         if ((buttons & 4) != 0)
         {
-            restartThread(flash4Hz);
+            resetTimer(flashTimer);
         }
         if ((buttons & 8) != 0)
         {
-            killThread(flash4Hz);
+            stopTimer(flashTimer);
         }
         if ((buttons & 16) != 0)
         {
@@ -215,25 +213,6 @@ void readKeys(void)
     }
 }
 
-void debounce(void)
-{
-    uint8_t count;
-    while(true)
-    {
-        wait(keyPressed);
-        count = 10;
-        while (count != 0)
-        {
-            sleep(10);
-            if (readPbs() == 0)
-                count--;
-            else
-                count = 10;
-        }
-        post(keyReleased);
-    }
-}
-
 void uncooperative(void)
 {
     while(true)
@@ -260,6 +239,7 @@ void errant(void)
 
 void important(void)
 {
+    HANDLE resource = findMutex("resource");
     while(true)
     {
         lock(resource);
@@ -16,14 +16,16 @@
 //-----------------------------------------------------------------------------
 
 void initHw(void);
+void powerUpFlash(void);
 
 void idle(void);
+void idle2(void);
+void idle3(void);
 void flash4Hz(void);
 void oneshot(void);
 void partOfLengthyFn(void);
 void lengthyFn(void);
 void readKeys(void);
-void debounce(void);
 void uncooperative(void);
 void errant(void);
 void important(void);
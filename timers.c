@@ -0,0 +1,245 @@
+// Software timers
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Timer callbacks run one after another in the timerTask thread, so periodic actions share its stack
+// instead of each needing a thread of its own
+// Armed timers are kept in a list sorted by expiry, the tick only looks at the head and the timer task
+// is notified when it is due
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tm4c123gh6pm.h"
+#include "kernel.h"
+#include "uart0.h"
+#include "timers.h"
+
+typedef struct _timer
+{
+    bool used;                     // slot holds a timer (see newTimer)
+    uint8_t generation;            // part of the handle, changes when the slot is reused
+    char name[IPC_NAME_SIZE];
+    _fn callback;                  // run by timerTask
+    uint32_t period;               // ticks
+    bool periodic;                 // re-armed one period after each expiry, otherwise one-shot
+    bool armed;
+    uint32_t expiry;               // timerTicks when it is due
+    uint8_t next;                  // next armed timer in expiry order, MAX_TIMERS ends the list
+} timer;
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+timer timers[MAX_TIMERS];
+uint8_t timerHead = MAX_TIMERS;    // armed timer due first
+uint32_t timerTicks = 0;           // ticks since initTimers, wraps
+uint8_t timerTaskIndex = MAX_TASKS; // tcb index of timerTask, found the first time a timer is due
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// returns the slot of a timer handle, or MAX_TIMERS if the handle is stale or invalid
+uint8_t timerIndex(HANDLE handle)
+{
+    uint8_t i = HANDLE_INDEX(handle);
+    if (i < MAX_TIMERS && timers[i].used && timers[i].generation == HANDLE_GENERATION(handle))
+        return i;
+    return MAX_TIMERS;
+}
+
+// adds a timer to the armed list behind the timers due at or before expiry
+void linkTimer(uint8_t i, uint32_t expiry)
+{
+    uint8_t *link = &timerHead;
+    while (*link != MAX_TIMERS && (int32_t)(timers[*link].expiry - expiry) <= 0)
+        link = &timers[*link].next;
+    timers[i].expiry = expiry;
+    timers[i].next = *link;
+    timers[i].armed = true;
+    *link = i;
+}
+
+void unlinkTimer(uint8_t i)
+{
+    uint8_t *link = &timerHead;
+    while (*link != MAX_TIMERS && *link != i)
+        link = &timers[*link].next;
+    if (*link == i) *link = timers[i].next;
+    timers[i].armed = false;
+}
+
+// empties the timer pool, called by initRtos
+void initTimers(void)
+{
+    uint8_t i;
+    for (i = 0; i < MAX_TIMERS; i++)
+        timers[i].used = false;
+    timerHead = MAX_TIMERS;
+    timerTicks = 0;
+    timerTaskIndex = MAX_TASKS;
+}
+
+// counts a tick and wakes the timer task once the first timer is due (systick)
+void tickTimers(void)
+{
+    timerTicks++;
+    if (timerHead != MAX_TIMERS && (int32_t)(timerTicks - timers[timerHead].expiry) >= 0)
+    {
+        if (timerTaskIndex == MAX_TASKS) timerTaskIndex = findTask(timerTask);
+        notifyTask(timerTaskIndex, 1, NOTIFY_SET_BITS);
+    }
+}
+
+// takes a timer from the pool, stopped (kernel side of createTimer)
+HANDLE newTimer(const char name[], _fn callback, uint32_t period, bool periodic)
+{
+    uint8_t i;
+    if (callback == NULL || period == 0) return NO_HANDLE;
+    for (i = 0; i < MAX_TIMERS && timers[i].used; i++);
+    if (i == MAX_TIMERS) return NO_HANDLE;
+    timers[i].used = true;
+    timers[i].generation = nextGeneration(timers[i].generation);
+    copyIpcName(timers[i].name, name);
+    timers[i].callback = callback;
+    timers[i].period = period;
+    timers[i].periodic = periodic;
+    timers[i].armed = false;
+    return MAKE_HANDLE(i, timers[i].generation);
+}
+
+// stops a timer and returns it to the pool
+bool deleteTimer(HANDLE handle)
+{
+    uint8_t i = timerIndex(handle);
+    if (i == MAX_TIMERS) return false;
+    if (timers[i].armed) unlinkTimer(i);
+    timers[i].used = false;
+    return true;
+}
+
+// arms a timer to expire one period from now, an armed timer is left alone unless restart is set
+bool armTimer(HANDLE handle, bool restart)
+{
+    uint8_t i = timerIndex(handle);
+    if (i == MAX_TIMERS) return false;
+    if (timers[i].armed)
+    {
+        if (!restart) return true;
+        unlinkTimer(i);
+    }
+    linkTimer(i, timerTicks + timers[i].period);
+    return true;
+}
+
+bool disarmTimer(HANDLE handle)
+{
+    uint8_t i = timerIndex(handle);
+    if (i == MAX_TIMERS) return false;
+    if (timers[i].armed) unlinkTimer(i);
+    return true;
+}
+
+// handle of the named timer, NO_HANDLE if there is none
+HANDLE lookupTimer(const char name[])
+{
+    uint8_t i;
+    for (i = 0; i < MAX_TIMERS; i++)
+        if (timers[i].used && sameIpcName(timers[i].name, name))
+            return MAKE_HANDLE(i, timers[i].generation);
+    return NO_HANDLE;
+}
+
+// takes the first timer off the armed list if it is due and returns its callback, NULL if none is due
+// periodic timers go back on the list one period after the expiry, so they keep their rate when the task runs late
+_fn takeExpiredTimer(void)
+{
+    uint8_t i = timerHead;
+    if (i == MAX_TIMERS || (int32_t)(timerTicks - timers[i].expiry) < 0) return NULL;
+    timerHead = timers[i].next;
+    timers[i].armed = false;
+    if (timers[i].periodic) linkTimer(i, timers[i].expiry + timers[i].period);
+    return timers[i].callback;
+}
+
+// service calls (asm.s)
+HANDLE timerCreate(const char name[], _fn callback, uint32_t period, bool periodic);
+bool timerDestroy(HANDLE handle);
+bool timerStart(HANDLE handle);
+bool timerStop(HANDLE handle);
+bool timerReset(HANDLE handle);
+
+// creates a stopped timer that runs callback in the timer task after period ticks, once or every period
+// name is optional and used by findTimer
+HANDLE createTimer(const char name[], _fn callback, uint32_t period, bool periodic)
+{
+    if (calledFromTask())
+        return timerCreate(name, callback, period, periodic);
+    return newTimer(name, callback, period, periodic);
+}
+
+bool destroyTimer(HANDLE handle)
+{
+    if (calledFromTask())
+        return timerDestroy(handle);
+    return deleteTimer(handle);
+}
+
+// starts a stopped timer, a running timer keeps its expiry
+bool startTimer(HANDLE handle)
+{
+    if (calledFromTask())
+        return timerStart(handle);
+    return armTimer(handle, false);
+}
+
+bool stopTimer(HANDLE handle)
+{
+    if (calledFromTask())
+        return timerStop(handle);
+    return disarmTimer(handle);
+}
+
+// starts the timer over, it expires one period from now whether or not it was running
+bool resetTimer(HANDLE handle)
+{
+    if (calledFromTask())
+        return timerReset(handle);
+    return armTimer(handle, true);
+}
+
+HANDLE timerFind(const char name[]);
+
+HANDLE findTimer(const char name[])
+{
+    if (calledFromTask())
+        return timerFind(name);
+    return lookupTimer(name);
+}
+
+// Takes the next due timer, the timer list is in OS memory so the timer task goes through the kernel
+_fn readExpiredTimer(void);
+
+// Runs the callbacks of due timers in order of expiry, callbacks should be short and must not block
+void timerTask(void)
+{
+    _fn callback;
+    while (true)
+    {
+        waitNotify(1, WAIT_FOREVER);
+        while ((callback = readExpiredTimer()) != NULL)
+            callback();
+    }
+}
@@ -0,0 +1,47 @@
+// Software timers
+// Angelina Abuhilal
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+#ifndef TIMERS_H_
+#define TIMERS_H_
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+
+#define MAX_TIMERS 8
+#define TIMER_ONE_SHOT false
+#define TIMER_PERIODIC true
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+void initTimers(void);
+void tickTimers(void);
+HANDLE newTimer(const char name[], _fn callback, uint32_t period, bool periodic);
+bool deleteTimer(HANDLE handle);
+bool armTimer(HANDLE handle, bool restart);
+bool disarmTimer(HANDLE handle);
+HANDLE lookupTimer(const char name[]);
+_fn takeExpiredTimer(void);
+
+HANDLE createTimer(const char name[], _fn callback, uint32_t period, bool periodic);
+bool destroyTimer(HANDLE handle);
+bool startTimer(HANDLE handle);
+bool stopTimer(HANDLE handle);
+bool resetTimer(HANDLE handle);
+HANDLE findTimer(const char name[]);
+void timerTask(void);
+
+#endif
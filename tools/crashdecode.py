@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+# Post-mortem decoder for the output of the shell's "crash" command
+#
+# Code addresses in the frame and the stack snapshot are mapped to functions with the
+# symbol table of the linked ELF (see profile.py), fault status bits are named and raw
+# log events are decoded with the LOG_MESSAGES table (see logdecode.py).
+#
+#   python3 tools/crashdecode.py RTOS.out capture.txt
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import logdecode  # noqa: E402
+import profile as symbols  # noqa: E402
+
+FLASH_END = 0x00040000
+
+CFSR_BITS = [
+    (0, "IACCVIOL instruction access violation"),
+    (1, "DACCVIOL data access violation"),
+    (3, "MUNSTKERR fault on unstacking"),
+    (4, "MSTKERR fault on stacking"),
+    (5, "MLSPERR fault on lazy fp state"),
+    (7, "MMARVALID mmfar holds the address"),
+    (8, "IBUSERR instruction bus error"),
+    (9, "PRECISERR precise data bus error"),
+    (10, "IMPRECISERR imprecise data bus error (pc is after the access)"),
+    (11, "UNSTKERR bus fault on unstacking"),
+    (12, "STKERR bus fault on stacking"),
+    (13, "LSPERR bus fault on lazy fp state"),
+    (15, "BFARVALID bfar holds the address"),
+    (16, "UNDEFINSTR undefined instruction"),
+    (17, "INVSTATE invalid state (thumb bit clear)"),
+    (18, "INVPC invalid exception return"),
+    (19, "NOCP no coprocessor"),
+    (24, "UNALIGNED unaligned access"),
+    (25, "DIVBYZERO divide by zero"),
+]
+
+HFSR_BITS = [
+    (1, "VECTTBL vector table read"),
+    (30, "FORCED escalated from a configurable fault"),
+    (31, "DEBUGEVT debug event"),
+]
+
+
+def bits(value, table):
+    return [name for bit, name in table if value & (1 << bit)]
+
+
+def read_capture(path):
+    crash = {"title": None, "regs": {}, "stack": [], "tasks": {}, "log": []}
+    source = open(path, errors="replace") if path != "-" else sys.stdin
+    for line in source:
+        line = line.strip()
+        m = re.match(r"#crash (.*)", line)
+        if m:
+            crash["title"] = m.group(1)
+            continue
+        m = re.match(r"#task (\d+) (\S+)", line)
+        if m:
+            crash["tasks"][int(m.group(1))] = m.group(2)
+            continue
+        if line.startswith("log "):
+            crash["log"].append(line[4:])
+            continue
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] == "stack":
+            crash["stack"] += [int(word, 16) for word in fields[1:]]
+        elif len(fields) == 2 and re.match(r"0x[0-9A-Fa-f]+$", fields[1]):
+            crash["regs"][fields[0]] = int(fields[1], 16)
+    return crash
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("elf", help="linked image with symbols")
+    parser.add_argument("capture", help="terminal capture of 'crash' (- for stdin)")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--header", default=logdecode.LOG_H, help="path to log.h")
+    opts = parser.parse_args()
+
+    crash = read_capture(opts.capture)
+    if crash["title"] is None:
+        sys.exit("no crash record in " + opts.capture)
+    addrs, names = symbols.load_symbols(opts.elf, opts.nm)
+    table = logdecode.load_table(opts.header)
+
+    def where(value):
+        if value >= FLASH_END or not addrs or value < addrs[0]:
+            return ""
+        return symbols.symbolize(value & ~1, addrs, names)
+
+    regs = crash["regs"]
+    print(crash["title"])
+    for reg in ("pc", "lr", "r0", "r1", "r2", "r3", "r12", "xpsr", "psp"):
+        if reg in regs:
+            print("  %-5s 0x%08X  %s" % (reg, regs[reg], where(regs[reg]) if reg in ("pc", "lr") else ""))
+
+    cfsr, hfsr = regs.get("cfsr", 0), regs.get("hfsr", 0)
+    print("cfsr 0x%08X" % cfsr)
+    for name in bits(cfsr, CFSR_BITS):
+        print("  " + name)
+    print("hfsr 0x%08X" % hfsr)
+    for name in bits(hfsr, HFSR_BITS):
+        print("  " + name)
+    if cfsr & (1 << 7):
+        print("mmfar 0x%08X" % regs.get("mmfar", 0))
+    if cfsr & (1 << 15):
+        print("bfar 0x%08X" % regs.get("bfar", 0))
+
+    # words above the frame that point into flash are likely return addresses
+    print("stack above the frame:")
+    for i, word in enumerate(crash["stack"]):
+        name = where(word) if word & 1 else ""
+        print("  [psp+0x%02X] 0x%08X  %s" % (32 + 4 * i, word, name))
+
+    print("last log events:")
+    for line in crash["log"]:
+        if line.startswith("#"):
+            # raw records name tasks by index, the #task lines give the names
+            fields = line[1:].split()
+            if len(fields) > 3 and fields[2].isdigit():
+                fields[3] = crash["tasks"].get(int(fields[2]), fields[3])
+                line = "#" + " ".join(fields)
+            print("  " + logdecode.decode(line, table))
+        else:
+            print("  " + line)
+
+
+if __name__ == "__main__":
+    main()
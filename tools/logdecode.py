@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Decodes raw log records printed by logDrain when logRaw is set (see log.c)
+#
+# The ID to format table is read from the LOG_MESSAGES list in log.h, so it always
+# matches the firmware built from the same tree.
+#
+#   python3 tools/logdecode.py capture.txt        decode a saved terminal capture
+#   python3 tools/logdecode.py < /dev/ttyACM0     decode live
+#   python3 tools/logdecode.py --table            print the ID table
+
+import argparse
+import os
+import re
+import sys
+
+CLOCK_HZ = 40e6
+LOG_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "log.h")
+
+
+def load_table(path):
+    with open(path) as f:
+        text = f.read()
+    block = re.search(r"#define LOG_MESSAGES(.*?)\n\s*\n", text, re.S)
+    if not block:
+        sys.exit("LOG_MESSAGES not found in " + path)
+    return re.findall(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', block.group(1))
+
+
+def expand(fmt, args):
+    args = list(args)
+
+    def field(m):
+        if not args:
+            return m.group(0)
+        value = args.pop(0)
+        return str(value) if m.group(1) == "u" else "0x%X" % value
+
+    return re.sub(r"%([ux])", field, fmt)
+
+
+def decode(line, table):
+    # "#id time task name arg0 arg1 dropped"
+    fields = line.strip()[1:].split()
+    if len(fields) < 5:
+        return line.rstrip()
+    msg_id = int(fields[0])
+    time = int(fields[1], 16)
+    name = fields[3]
+    args = [int(a, 16) for a in fields[4:-1]]
+    dropped = int(fields[-1])
+    text = expand(table[msg_id][1], args) if msg_id < len(table) else "unknown log id %d" % msg_id
+    prefix = "(%d dropped) " % dropped if dropped else ""
+    return "%10.6f %s%s: %s" % (time / CLOCK_HZ, prefix, name, text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("capture", nargs="?", help="terminal capture (default stdin)")
+    parser.add_argument("--header", default=LOG_H, help="path to log.h")
+    parser.add_argument("--table", action="store_true", help="print the ID table and exit")
+    opts = parser.parse_args()
+
+    table = load_table(opts.header)
+    if opts.table:
+        for i, (name, fmt) in enumerate(table):
+            print("%3d %-20s %s" % (i, name, fmt))
+        return
+
+    source = open(opts.capture, errors="replace") if opts.capture else sys.stdin
+    for line in source:
+        print(decode(line, table) if line.startswith("#") else line.rstrip())
+
+
+if __name__ == "__main__":
+    main()
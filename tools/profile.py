@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Flat profile from the output of the shell's "profile stop" command
+#
+# PCs are mapped to functions with the symbol table of the linked ELF (.out),
+# read with nm (arm-none-eabi-nm by default, --nm to change it).
+#
+#   python3 tools/profile.py RTOS.out capture.txt
+#   python3 tools/profile.py RTOS.out capture.txt --task Shell
+
+import argparse
+import bisect
+import collections
+import re
+import subprocess
+import sys
+
+
+def load_symbols(elf, nm):
+    out = subprocess.run([nm, "-n", "--defined-only", elf], check=True,
+                         capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) < 3 or parts[1].lower() != "t":
+            continue
+        addrs.append(int(parts[0], 16) & ~1)  # thumb bit
+        names.append(parts[2])
+    return addrs, names
+
+
+def symbolize(pc, addrs, names):
+    i = bisect.bisect_right(addrs, pc) - 1
+    return names[i] if i >= 0 else "0x%08X" % pc
+
+
+def read_capture(path):
+    tasks = {}
+    samples = []
+    source = open(path, errors="replace") if path != "-" else sys.stdin
+    for line in source:
+        line = line.strip()
+        m = re.match(r"#task (\d+) (\S+)", line)
+        if m:
+            tasks[int(m.group(1))] = m.group(2)
+        elif line.startswith("$"):
+            for field in line[1:].split():
+                task, pc = field.split(":")
+                samples.append((int(task), int(pc, 16)))
+    return tasks, samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("elf", help="linked image with symbols")
+    parser.add_argument("capture", help="terminal capture of 'profile stop' (- for stdin)")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--task", help="only this task")
+    parser.add_argument("--top", type=int, default=20, help="functions shown per task")
+    opts = parser.parse_args()
+
+    addrs, names = load_symbols(opts.elf, opts.nm)
+    tasks, samples = read_capture(opts.capture)
+    if not samples:
+        sys.exit("no samples in " + opts.capture)
+
+    per_task = collections.defaultdict(collections.Counter)
+    for task, pc in samples:
+        per_task[tasks.get(task, "task%d" % task)][symbolize(pc, addrs, names)] += 1
+
+    total = len(samples)
+    for task, counter in sorted(per_task.items(), key=lambda t: -sum(t[1].values())):
+        if opts.task and task != opts.task:
+            continue
+        task_total = sum(counter.values())
+        print("%s: %d samples (%.1f%%)" % (task, task_total, 100.0 * task_total / total))
+        for function, n in counter.most_common(opts.top):
+            print("  %6d %5.1f%%  %s" % (n, 100.0 * n / task_total, function))
+
+
+if __name__ == "__main__":
+    main()
@@ -22,15 +22,52 @@
 #include <stdbool.h>
 #include "tm4c123gh6pm.h"
 #include "uart0.h"
+#include "asm.h"
+#include "kernel.h"
+#include "mm.h"
 
 // PortA masks
 #define UART_TX_MASK 2
 #define UART_RX_MASK 1
 
+// Ring buffer sizes (power of 2)
+#define TX_BUFFER_SIZE 256
+#define RX_BUFFER_SIZE 128                              // holds a full shell line
+
+// uDMA
+#define DMA_CHANNEL 9                                   // UART0 TX (encoding 0)
+#define DMA_MAX_TRANSFER 1024                           // items per basic mode transfer
+
 //-----------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------
 
+// Buffers live in kernel memory, so tasks reach them through service calls
+char txBuffer[TX_BUFFER_SIZE];
+volatile uint16_t txWrite = 0;
+volatile uint16_t txRead = 0;
+uint8_t txWaiters = 0;                                  // tasks blocked on uartTxSpace
+
+char rxBuffer[RX_BUFFER_SIZE];
+volatile uint16_t rxWrite = 0;
+volatile uint16_t rxRead = 0;
+volatile uint16_t rxLineEnd = 0;                        // end of the last completed line, uart0Isr edits the rest
+
+// uDMA control table, only the primary entry of channel 9 is used (source end, destination end, control, unused)
+#pragma DATA_ALIGN(dmaTable, 1024)
+volatile uint32_t dmaTable[(DMA_CHANNEL + 1) * 4];
+bool dmaActive = false;                                 // uDMA owns the tx fifo
+bool dmaPending = false;                                // waiting for the tx buffer to drain before starting
+bool dmaRelease = false;                                // buffer is a kernel buffer to free when done
+char* dmaBuffer;
+char* dmaNext;
+uint16_t dmaRemaining = 0;
+
+// dump being formatted by beginDump/dumpStr/endDump
+char* dumpBuffer = NULL;
+uint16_t dumpLength = 0;
+uint16_t dumpSize = 0;
+
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
@@ -59,6 +96,30 @@ void initUart0()
     UART0_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_FEN;    // configure for 8N1 w/ 16-level FIFO
     UART0_CTL_R = UART_CTL_TXE | UART_CTL_RXE | UART_CTL_UARTEN;
                                                         // enable TX, RX, and module
+
+    // Interrupt when the tx fifo is nearly empty and when data is received (or has sat in the rx fifo)
+    UART0_IFLS_R = UART_IFLS_TX1_8 | UART_IFLS_RX1_8;
+    UART0_IM_R = UART_IM_TXIM | UART_IM_RXIM | UART_IM_RTIM;
+    // uart0Isr posts semaphores directly, so it runs at the kernel's priority and never preempts it
+    NVIC_PRI1_R = (NVIC_PRI1_R & ~NVIC_PRI1_INT5_M) | (KERNEL_PRIORITY << NVIC_PRI1_INT5_S);
+    NVIC_EN0_R |= 1 << (INT_UART0 - 16);                // turn-on interrupt 21 (UART0)
+
+    initUart0Dma();
+}
+
+// Initialize uDMA channel 9 to feed the UART0 tx fifo
+// uDMA completion for a peripheral channel is signalled on the peripheral's interrupt (uart0Isr)
+void initUart0Dma()
+{
+    SYSCTL_RCGCDMA_R |= SYSCTL_RCGCDMA_R0;
+    _delay_cycles(3);
+    UDMA_CFG_R = UDMA_CFG_MASTEN;                       // enable controller
+    UDMA_CTLBASE_R = (uint32_t)dmaTable;                // control table (1KiB aligned)
+    UDMA_CHMAP1_R &= ~UDMA_CHMAP1_CH9_M;                // channel 9 is UART0 TX
+    UDMA_PRIOCLR_R = 1 << DMA_CHANNEL;                  // default priority
+    UDMA_ALTCLR_R = 1 << DMA_CHANNEL;                   // primary control structure
+    UDMA_USEBURSTCLR_R = 1 << DMA_CHANNEL;              // single and burst requests
+    UDMA_REQMASKCLR_R = 1 << DMA_CHANNEL;               // allow requests from UART0
 }
 
 // Set baud rate as function of instruction cycle frequency
@@ -75,30 +136,325 @@ void setUart0BaudRate(uint32_t baudRate, uint32_t fcyc)
                                                         // turn-on UART0
 }
 
-// Blocking function that writes a serial character when the UART buffer is not full
+// Tasks run unprivileged in thread mode and must use service calls, the kernel and isrs use the buffers directly
+bool calledFromTask()
+{
+    return (getIpsr() == 0) && (getControl() & 1);
+}
+
+// Programs the next (up to 1KiB) chunk of the uDMA transfer
+void startDmaChunk()
+{
+    uint16_t n = dmaRemaining;
+    if (n > DMA_MAX_TRANSFER) n = DMA_MAX_TRANSFER;
+    dmaTable[DMA_CHANNEL * 4 + 0] = (uint32_t)(dmaNext + n - 1);    // source end pointer
+    dmaTable[DMA_CHANNEL * 4 + 1] = (uint32_t)&UART0_DR_R;          // destination end pointer
+    dmaTable[DMA_CHANNEL * 4 + 2] = UDMA_CHCTL_DSTINC_NONE | UDMA_CHCTL_DSTSIZE_8 |
+                                    UDMA_CHCTL_SRCINC_8 | UDMA_CHCTL_SRCSIZE_8 |
+                                    UDMA_CHCTL_ARBSIZE_4 | ((n - 1) << UDMA_CHCTL_XFERSIZE_S) |
+                                    UDMA_CHCTL_XFERMODE_BASIC;
+    dmaNext += n;
+    dmaRemaining -= n;
+    dmaActive = true;
+    UART0_DMACTL_R |= UART_DMACTL_TXDMAE;
+    UDMA_ENASET_R = 1 << DMA_CHANNEL;
+}
+
+// Handles uDMA completion: starts the next chunk, or hands the fifo back to the tx buffer
+// Called from uart0Isr and polled by kernel writers, which may run while uart0Isr cannot
+void updateDma()
+{
+    if (dmaActive && (UDMA_CHIS_R & (1 << DMA_CHANNEL)))
+    {
+        UDMA_CHIS_R = 1 << DMA_CHANNEL;                 // clear (write 1 to clear)
+        if (dmaRemaining > 0)
+            startDmaChunk();
+        else
+        {
+            dmaActive = false;
+            UART0_DMACTL_R &= ~UART_DMACTL_TXDMAE;
+            if (dmaRelease)
+                freeKernelBuffer(dmaBuffer);
+            else
+                signalSemaphore(uartDmaDone);
+        }
+    }
+}
+
+// Moves characters from the tx buffer into the fifo until one is full or the other is empty
+// A pending uDMA transfer starts once the tx buffer is empty, so output stays in order
+void fillTxFifo()
+{
+    updateDma();
+    if (dmaActive) return;
+    while (txRead != txWrite && !(UART0_FR_R & UART_FR_TXFF))
+    {
+        UART0_DR_R = txBuffer[txRead];
+        txRead = (txRead + 1) & (TX_BUFFER_SIZE - 1);
+    }
+    if (dmaPending && txRead == txWrite)
+    {
+        dmaPending = false;
+        startDmaChunk();
+    }
+}
+
+// Queues a uDMA transfer of buffer to the tx fifo and returns immediately, false if a transfer is in progress
+// A kernel buffer from allocKernelBuffer can be freed on completion (release), otherwise uartDmaDone is posted
+bool startUart0Dma(char* buffer, uint16_t length, bool release)
+{
+    if (dmaActive || dmaPending || length == 0) return false;
+    dmaBuffer = buffer;
+    dmaNext = buffer;
+    dmaRemaining = length;
+    dmaRelease = release;
+    dmaPending = true;
+    fillTxFifo();
+    return true;
+}
+
+// Starts writing a large buffer through uDMA from a task, which continues while it is sent
+// The buffer must not change until uartDmaDone is posted, returns false if a transfer is in progress
+bool writeUart0Dma(const char* buffer, uint16_t length);
+
+// Starts formatting a diagnostic dump of up to size characters into a kernel buffer that is sent by uDMA
+// Falls back to the tx buffer if there is no heap space or a transfer is in progress
+// Fault handlers (exceptions 3 to 6) always use the tx buffer, written by polling, since a fault may halt
+// before uart0Isr could start the transfer
+void beginDump(uint16_t size)
+{
+    uint32_t exception = getIpsr() & 0x1FF;
+    if (dumpBuffer != NULL) endDump();
+    dumpLength = 0;
+    dumpSize = size;
+    if (!dmaActive && !dmaPending && (exception < 3 || exception > 6))
+        dumpBuffer = allocKernelBuffer(size);
+}
+
+// Adds a string to the dump
+void dumpStr(char* str)
+{
+    uint16_t i = 0;
+    if (dumpBuffer == NULL)
+    {
+        putsUart0(str);
+        return;
+    }
+    while (str[i] != '\0' && dumpLength < dumpSize)
+        dumpBuffer[dumpLength++] = str[i++];
+}
+
+// Hands the dump to uDMA, the buffer is freed when the transfer completes
+void endDump()
+{
+    if (dumpBuffer != NULL && !startUart0Dma(dumpBuffer, dumpLength, true))
+        freeKernelBuffer(dumpBuffer);
+    dumpBuffer = NULL;
+}
+
+// Sends everything still queued (a uDMA transfer and the tx buffer) by polling and waits for the last character
+// Used before halting, when uart0Isr will never run again
+void flushUart0()
+{
+    while (dmaActive || dmaPending || txRead != txWrite)
+        fillTxFifo();
+    while (UART0_FR_R & UART_FR_BUSY);
+}
+
+// Copies as much of str into the tx buffer as fits and starts transmitting, returns the number of characters copied
+// A short count leaves the caller counted in txWaiters, to be woken through uartTxSpace
+uint16_t writeUart0Buffer(const char* str)
+{
+    uint16_t count = 0;
+    uint16_t next;
+    while (str[count] != '\0')
+    {
+        next = (txWrite + 1) & (TX_BUFFER_SIZE - 1);
+        if (next == txRead)
+        {
+            txWaiters++;
+            break;
+        }
+        txBuffer[txWrite] = str[count++];
+        txWrite = next;
+    }
+    fillTxFifo();                                    // the tx interrupt only fires as the fifo drains
+    return count;
+}
+
+// Returns the next received character, or 0 if there is none
+char readUart0Buffer()
+{
+    char c = 0;
+    if (rxRead != rxWrite)
+    {
+        if (rxLineEnd == rxRead)                     // kernel code reads lines that are not complete
+            rxLineEnd = (rxRead + 1) & (RX_BUFFER_SIZE - 1);
+        c = rxBuffer[rxRead];
+        rxRead = (rxRead + 1) & (RX_BUFFER_SIZE - 1);
+    }
+    return c;
+}
+
+// Returns true if a completed line has characters left to read
+bool rxLineReady()
+{
+    return rxRead != rxLineEnd;
+}
+
+// Copies the oldest completed line without the carriage return, false if no line is complete
+// Characters past size - 1 are discarded
+bool readUart0Line(char buffer[], uint8_t size)
+{
+    uint8_t count = 0;
+    char c;
+    if (rxRead == rxLineEnd) return false;
+    while (rxRead != rxLineEnd)
+    {
+        c = rxBuffer[rxRead];
+        rxRead = (rxRead + 1) & (RX_BUFFER_SIZE - 1);
+        if (c == 13) break;
+        if (count < size - 1) buffer[count++] = c;
+    }
+    buffer[count] = '\0';
+    return true;
+}
+
+// Puts a character in the tx buffer from kernel code, which cannot block
+// If the buffer is full it is drained by polling, since uart0Isr cannot preempt a handler of the same priority
+// The tx interrupt is masked meanwhile so uart0Isr cannot move txRead under privileged thread code (main)
+void putcUart0Kernel(char c)
+{
+    uint16_t next = (txWrite + 1) & (TX_BUFFER_SIZE - 1);
+    UART0_IM_R &= ~UART_IM_TXIM;
+    while (next == txRead)
+    {
+        fillTxFifo();
+    }
+    txBuffer[txWrite] = c;
+    txWrite = next;
+    fillTxFifo();
+    UART0_IM_R |= UART_IM_TXIM;
+}
+
+// Writes a serial character, a task blocks only while the tx buffer is full
 void putcUart0(char c)
 {
-    while (UART0_FR_R & UART_FR_TXFF);               // wait if uart0 tx fifo full
-    UART0_DR_R = c;                                  // write character to fifo
+    char str[2];
+    if (calledFromTask())
+    {
+        str[0] = c;
+        str[1] = '\0';
+        putsUart0(str);
+    }
+    else
+        putcUart0Kernel(c);
 }
 
-// Blocking function that writes a string when the UART buffer is not full
+// Writes a string, a task blocks only while the tx buffer is full
 void putsUart0(char* str)
 {
-    uint8_t i = 0;
-    while (str[i] != '\0')
-        putcUart0(str[i++]);
+    uint16_t i = 0;
+    if (calledFromTask())
+    {
+        while (str[i] != '\0')
+            i += uartWrite(str + i);
+    }
+    else
+    {
+        while (str[i] != '\0')
+            putcUart0Kernel(str[i++]);
+    }
 }
 
-// Blocking function that returns with serial data once the buffer is not empty
+// Returns with serial data once the buffer is not empty, a task sleeps until a character arrives
 char getcUart0()
 {
-    while (UART0_FR_R & UART_FR_RXFE);               // wait if uart0 rx fifo empty
-    return UART0_DR_R & 0xFF;                        // get character from fifo
+    if (calledFromTask())
+    {
+        while (!uartKbhit())
+            wait(uartRxLine);
+        return uartRead();
+    }
+    while (rxRead == rxWrite)                        // kernel code polls, pulling from the fifo itself
+    {
+        if (!(UART0_FR_R & UART_FR_RXFE))
+            return UART0_DR_R & 0xFF;
+    }
+    return readUart0Buffer();
+}
+
+// Reads a line into buffer (size includes the null), a task sleeps until enter is pressed
+// uart0Isr echoes and handles backspace, so nothing runs per keystroke
+void getsUart0Line(char buffer[], uint8_t size)
+{
+    if (calledFromTask())
+    {
+        while (!uartReadLine(buffer, size))
+            wait(uartRxLine);
+        return;
+    }
+    while (!readUart0Line(buffer, size));           // kernel code polls
 }
 
-// Returns the status of the receive buffer
+// Returns the status of the receive buffer (completed lines only for tasks)
 bool kbhitUart0()
 {
-    return !(UART0_FR_R & UART_FR_RXFE);
+    if (calledFromTask())
+        return uartKbhit();
+    return (rxRead != rxWrite) || !(UART0_FR_R & UART_FR_RXFE);
+}
+
+// Moves received characters into the rx buffer and refills the tx fifo, waking tasks waiting on either
+void uart0Isr()
+{
+    uint16_t next;
+    updateDma();
+    if (UART0_MIS_R & (UART_MIS_RXMIS | UART_MIS_RTMIS))
+    {
+        UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+        while (!(UART0_FR_R & UART_FR_RXFE))
+        {
+            next = (rxWrite + 1) & (RX_BUFFER_SIZE - 1);
+            char c = UART0_DR_R & 0xFF;
+            // backspace removes a character of the line being typed
+            if (c == 8 || c == 127)
+            {
+                if (rxWrite != rxLineEnd)
+                {
+                    rxWrite = (rxWrite - 1) & (RX_BUFFER_SIZE - 1);
+                    putcUart0Kernel(c);
+                }
+            }
+            // carriage return completes the line and wakes the reader
+            else if (c == 13)
+            {
+                if (next != rxRead)
+                {
+                    rxBuffer[rxWrite] = c;
+                    rxWrite = next;
+                    rxLineEnd = next;
+                    putcUart0Kernel(c);
+                    signalSemaphore(uartRxLine);
+                }
+            }
+            // printable characters, a slot is always kept for the carriage return
+            else if (c >= 32 && ((next + 1) & (RX_BUFFER_SIZE - 1)) != rxRead)
+            {
+                rxBuffer[rxWrite] = c;
+                rxWrite = next;
+                putcUart0Kernel(c);
+            }
+        }
+    }
+    if (UART0_MIS_R & UART_MIS_TXMIS)
+    {
+        UART0_ICR_R = UART_ICR_TXIC;
+        fillTxFifo();
+        while (txWaiters > 0)
+        {
+            txWaiters--;
+            signalSemaphore(uartTxSpace);
+        }
+    }
 }
@@ -34,5 +34,23 @@ void putcUart0(char c);
 void putsUart0(char* str);
 char getcUart0();
 bool kbhitUart0();
+uint16_t writeUart0Buffer(const char* str);
+char readUart0Buffer();
+bool rxLineReady();
+bool readUart0Line(char buffer[], uint8_t size);
+void getsUart0Line(char buffer[], uint8_t size);
+void uart0Isr();
+bool calledFromTask();
+uint16_t uartWrite(const char* str);
+char uartRead();
+bool uartKbhit();
+bool uartReadLine(char buffer[], uint8_t size);
+void initUart0Dma();
+bool startUart0Dma(char* buffer, uint16_t length, bool release);
+bool writeUart0Dma(const char* buffer, uint16_t length);
+void beginDump(uint16_t size);
+void dumpStr(char* str);
+void endDump();
+void flushUart0();
 
 #endif